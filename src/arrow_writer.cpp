@@ -0,0 +1,335 @@
+/* arrow_writer.cpp
+ *
+ * Copyright (C) 2018 Tyler Burdsall
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ARROW_WRITER_CPP
+#define ARROW_WRITER_CPP
+
+#include <limits>
+#include <utility>
+#include "arrow_writer.h"
+#include "row_serializer.h"
+
+// Values from the Arrow flatbuffer schemas (Schema.fbs and Message.fbs)
+const short                  ARROW_METADATA_V5 = 4;
+const unsigned char          ARROW_HEADER_SCHEMA = 1;
+const unsigned char          ARROW_HEADER_DICTIONARY_BATCH = 2;
+const unsigned char          ARROW_HEADER_RECORD_BATCH = 3;
+const unsigned char          ARROW_TYPE_UTF8 = 5;
+const unsigned char          ARROW_TYPE_LARGE_UTF8 = 20;
+
+typedef std::pair<long long, long long> arrow_pair;
+
+/*
+ * Just enough of a FlatBuffers builder to encode Arrow messages. Like the
+ * reference implementation it builds the buffer back to front, so every
+ * object is finished before the objects that refer to it, and positions are
+ * measured from the end of the buffer.
+ */
+class flatbuffer_builder
+{
+public:
+    size_t size() const
+    {
+        return data.size();
+    }
+
+    void align(const size_t &alignment, const size_t &upcoming)
+    {
+        data.insert(0, (alignment - (data.size() + upcoming) % alignment) % alignment, '\0');
+    }
+
+    void prepend(const unsigned long long &value, const size_t &width)
+    {
+        align(width, 0);
+        string bytes;
+        append_little_endian(value, width, bytes);
+        data.insert(0, bytes);
+    }
+
+    void prepend_offset(const size_t &target)
+    {
+        align(4, 0);
+        prepend(data.size() + 4 - target, 4);
+    }
+
+    size_t add_string(const string &value)
+    {
+        align(4, value.size() + 1);
+        data.insert(0, 1, '\0');
+        data.insert(0, value);
+        prepend(value.size(), 4);
+        return size();
+    }
+
+    size_t add_offsets(const vector<size_t> &targets)
+    {
+        align(4, 4 * targets.size());
+        for (size_t i = targets.size(); i > 0; --i)
+        {
+            prepend_offset(targets[i - 1]);
+        }
+        prepend(targets.size(), 4);
+        return size();
+    }
+
+    // Vector of two-long structs (FieldNode and Buffer)
+    size_t add_pairs(const vector<arrow_pair> &pairs)
+    {
+        align(8, 16 * pairs.size());
+        for (size_t i = pairs.size(); i > 0; --i)
+        {
+            prepend(static_cast<unsigned long long>(pairs[i - 1].second), 8);
+            prepend(static_cast<unsigned long long>(pairs[i - 1].first), 8);
+        }
+        prepend(pairs.size(), 4);
+        return size();
+    }
+
+    void start_table()
+    {
+        fields.clear();
+        table_start = size();
+    }
+
+    void add_scalar(const size_t &id, const unsigned long long &value, const size_t &width)
+    {
+        prepend(value, width);
+        fields.push_back(std::make_pair(id, size()));
+    }
+
+    void add_offset(const size_t &id, const size_t &target)
+    {
+        prepend_offset(target);
+        fields.push_back(std::make_pair(id, size()));
+    }
+
+    // Writes the table's vtable right in front of it and returns the table
+    size_t end_table()
+    {
+        prepend(0, 4);
+        const size_t table = size();
+        vector<unsigned long long> slots;
+        for (const std::pair<size_t, size_t> &field: fields)
+        {
+            if (slots.size() <= field.first)
+            {
+                slots.resize(field.first + 1, 0);
+            }
+            slots[field.first] = table - field.second;
+        }
+        for (size_t i = slots.size(); i > 0; --i)
+        {
+            prepend(slots[i - 1], 2);
+        }
+        prepend(table - table_start, 2);
+        prepend(4 + 2 * slots.size(), 2);
+        string soffset;
+        append_little_endian(size() - table, 4, soffset);
+        data.replace(data.size() - table, 4, soffset);
+        return table;
+    }
+
+    const string &finish(const size_t &root)
+    {
+        align(8, 4);
+        prepend_offset(root);
+        return data;
+    }
+
+private:
+    string                                  data;
+    vector<std::pair<size_t, size_t>>       fields;
+    size_t                                  table_start = 0;
+};
+
+static size_t padded(const size_t &length)
+{
+    return (length + 7) / 8 * 8;
+}
+
+static void append_padded(const string &bytes, string &out)
+{
+    out += bytes;
+    out.append(padded(bytes.size()) - bytes.size(), '\0');
+}
+
+static size_t add_message(flatbuffer_builder &fb, const unsigned char &header_type, const size_t &header, const size_t &body_length)
+{
+    fb.start_table();
+    fb.add_scalar(3, body_length, 8);
+    fb.add_offset(2, header);
+    fb.add_scalar(0, ARROW_METADATA_V5, 2);
+    fb.add_scalar(1, header_type, 1);
+    return fb.end_table();
+}
+
+static size_t add_record_batch(flatbuffer_builder &fb, const size_t &length, const vector<arrow_pair> &nodes, const vector<arrow_pair> &buffers)
+{
+    const size_t node_vector = fb.add_pairs(nodes);
+    const size_t buffer_vector = fb.add_pairs(buffers);
+    fb.start_table();
+    fb.add_scalar(0, length, 8);
+    fb.add_offset(1, node_vector);
+    fb.add_offset(2, buffer_vector);
+    return fb.end_table();
+}
+
+// Encapsulated message: continuation marker, metadata length, the flatbuffer
+// padded so that the body that follows starts on an 8-byte boundary
+static void append_message(const string &metadata, const string &body, string &out)
+{
+    append_little_endian(0xFFFFFFFFULL, 4, out);
+    append_little_endian(padded(metadata.size()), 4, out);
+    append_padded(metadata, out);
+    out += body;
+}
+
+// Signed index types, since that is what Arrow implementations expect
+const size_t arrow_index_width(const size_t &cardinality)
+{
+    const unsigned long long max_index = cardinality > 0 ? cardinality - 1 : 0;
+    if (max_index <= 0x7FULL)
+    {
+        return 1;
+    }
+    if (max_index <= 0x7FFFULL)
+    {
+        return 2;
+    }
+    if (max_index <= 0x7FFFFFFFULL)
+    {
+        return 4;
+    }
+    return 8;
+}
+
+static bool needs_large_utf8(const value_column &values)
+{
+    size_t total = 0;
+    for (const value_view &value: values)
+    {
+        total += value.size;
+    }
+    return total > static_cast<size_t>(std::numeric_limits<int>::max());
+}
+
+static void append_schema_message(const generation_args &args, string &out)
+{
+    const value_table &combinations = args.pc.combinations;
+    flatbuffer_builder fb;
+    vector<size_t> fields;
+    for (size_t j = 0; j < combinations.size(); ++j)
+    {
+        const size_t name = fb.add_string(args.pc.keys.empty() ? "f" + std::to_string(j) : args.pc.keys[j]);
+        fb.start_table();
+        const size_t value_type = fb.end_table();
+        fb.start_table();
+        fb.add_scalar(0, 8 * arrow_index_width(combinations[j].size()), 4);
+        fb.add_scalar(1, 1, 1);
+        const size_t index_type = fb.end_table();
+        fb.start_table();
+        fb.add_scalar(0, j, 8);
+        fb.add_offset(1, index_type);
+        const size_t dictionary = fb.end_table();
+        const size_t children = fb.add_offsets(vector<size_t>());
+        fb.start_table();
+        fb.add_offset(0, name);
+        fb.add_offset(3, value_type);
+        fb.add_offset(4, dictionary);
+        fb.add_offset(5, children);
+        fb.add_scalar(1, 0, 1);
+        fb.add_scalar(2, needs_large_utf8(combinations[j]) ? ARROW_TYPE_LARGE_UTF8 : ARROW_TYPE_UTF8, 1);
+        fields.push_back(fb.end_table());
+    }
+    const size_t field_vector = fb.add_offsets(fields);
+    fb.start_table();
+    fb.add_offset(1, field_vector);
+    fb.add_scalar(0, 0, 2);
+    const size_t schema = fb.end_table();
+    append_message(fb.finish(add_message(fb, ARROW_HEADER_SCHEMA, schema, 0)), "", out);
+}
+
+static void append_dictionary_batch(const size_t &id, const value_column &values, string &out)
+{
+    const size_t offset_width = needs_large_utf8(values) ? 8 : 4;
+    string offsets;
+    string bytes;
+    append_little_endian(0, offset_width, offsets);
+    for (const value_view &value: values)
+    {
+        bytes += value;
+        append_little_endian(bytes.size(), offset_width, offsets);
+    }
+    string body;
+    append_padded(offsets, body);
+    append_padded(bytes, body);
+
+    flatbuffer_builder fb;
+    const vector<arrow_pair> nodes = { arrow_pair(values.size(), 0) };
+    const vector<arrow_pair> buffers =
+    {
+        arrow_pair(0, 0),
+        arrow_pair(0, offsets.size()),
+        arrow_pair(padded(offsets.size()), bytes.size())
+    };
+    const size_t data = add_record_batch(fb, values.size(), nodes, buffers);
+    fb.start_table();
+    fb.add_scalar(0, id, 8);
+    fb.add_offset(1, data);
+    const size_t batch = fb.end_table();
+    append_message(fb.finish(add_message(fb, ARROW_HEADER_DICTIONARY_BATCH, batch, body.size())), body, out);
+}
+
+const void append_arrow_schema(const generation_args &args, string &out)
+{
+    append_schema_message(args, out);
+    for (size_t j = 0; j < args.pc.combinations.size(); ++j)
+    {
+        append_dictionary_batch(j, args.pc.combinations[j], out);
+    }
+}
+
+// columns[j] holds rows indices of column j, each at arrow_index_width bytes
+const void append_arrow_record_batch(const vector<string> &columns, const size_t &rows, string &out)
+{
+    vector<arrow_pair> nodes;
+    vector<arrow_pair> buffers;
+    size_t body_length = 0;
+    for (const string &column: columns)
+    {
+        nodes.push_back(arrow_pair(rows, 0));
+        buffers.push_back(arrow_pair(body_length, 0));
+        buffers.push_back(arrow_pair(body_length, column.size()));
+        body_length += padded(column.size());
+    }
+    flatbuffer_builder fb;
+    const size_t batch = add_record_batch(fb, rows, nodes, buffers);
+    append_message(fb.finish(add_message(fb, ARROW_HEADER_RECORD_BATCH, batch, body_length)), "", out);
+    for (const string &column: columns)
+    {
+        append_padded(column, out);
+    }
+}
+
+const void append_arrow_end_of_stream(string &out)
+{
+    append_little_endian(0xFFFFFFFFULL, 4, out);
+    append_little_endian(0, 4, out);
+}
+
+#endif
@@ -0,0 +1,36 @@
+/* arrow_writer.h
+ *
+ * Copyright (C) 2018 Tyler Burdsall
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ARROW_WRITER_H
+#define ARROW_WRITER_H
+
+#include "combigen.h"
+
+/*
+ * Writes the Apache Arrow IPC streaming format without depending on the Arrow
+ * library. Every column is a dictionary-encoded, non-nullable utf8 column: the
+ * stream starts with the schema and one dictionary batch per column holding
+ * that column's values, followed by record batches of signed integer value
+ * indices and the end-of-stream marker.
+ */
+const size_t                 arrow_index_width(const size_t &cardinality);
+const void                   append_arrow_schema(const generation_args &args, string &out);
+const void                   append_arrow_record_batch(const vector<string> &columns, const size_t &rows, string &out);
+const void                   append_arrow_end_of_stream(string &out);
+
+#endif
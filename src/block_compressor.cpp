@@ -0,0 +1,204 @@
+/* block_compressor.cpp
+ *
+ * Copyright (C) 2018 Tyler Burdsall
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef BLOCK_COMPRESSOR_CPP
+#define BLOCK_COMPRESSOR_CPP
+
+#include <cstdlib>
+#include <iostream>
+#include "block_compressor.h"
+
+#if defined(USE_ZLIB) || defined(USE_ZSTD)
+static void compression_failed(void)
+{
+    std::cerr << "ERROR: Unable to compress output\n";
+    exit(-1);
+}
+#endif
+
+block_codec::block_codec(const output_compression &compression)
+    : compression(compression)
+{
+#ifdef USE_ZLIB
+    deflate_stream = z_stream();
+    // 16 on top of the window bits asks zlib for a gzip wrapper
+    if (compression == output_compression::gzip
+        && deflateInit2(&deflate_stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+    {
+        compression_failed();
+    }
+#endif
+#ifdef USE_ZSTD
+    zstd_context = compression == output_compression::zstd ? ZSTD_createCCtx() : nullptr;
+    if (compression == output_compression::zstd && zstd_context == nullptr)
+    {
+        compression_failed();
+    }
+#endif
+}
+
+block_codec::~block_codec()
+{
+#ifdef USE_ZLIB
+    if (compression == output_compression::gzip)
+    {
+        deflateEnd(&deflate_stream);
+    }
+#endif
+#ifdef USE_ZSTD
+    ZSTD_freeCCtx(zstd_context);
+#endif
+}
+
+void block_codec::compress(const char *bytes, size_t size, std::string &out)
+{
+    while (size > 0)
+    {
+        const size_t piece = size < COMPRESSION_PIECE_SIZE ? size : COMPRESSION_PIECE_SIZE;
+#ifdef USE_ZLIB
+        if (compression == output_compression::gzip)
+        {
+            const size_t start = out.size();
+            deflateReset(&deflate_stream);
+            out.resize(start + deflateBound(&deflate_stream, static_cast<uLong>(piece)));
+            deflate_stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(bytes));
+            deflate_stream.avail_in = static_cast<uInt>(piece);
+            deflate_stream.next_out = reinterpret_cast<Bytef *>(&out[start]);
+            deflate_stream.avail_out = static_cast<uInt>(out.size() - start);
+            if (deflate(&deflate_stream, Z_FINISH) != Z_STREAM_END)
+            {
+                compression_failed();
+            }
+            out.resize(out.size() - deflate_stream.avail_out);
+        }
+#endif
+#ifdef USE_ZSTD
+        if (compression == output_compression::zstd)
+        {
+            const size_t start = out.size();
+            out.resize(start + ZSTD_compressBound(piece));
+            // Level 0 is zstd's default level
+            const size_t written = ZSTD_compressCCtx(zstd_context, &out[start], out.size() - start, bytes, piece, 0);
+            if (ZSTD_isError(written))
+            {
+                compression_failed();
+            }
+            out.resize(start + written);
+        }
+#endif
+        bytes += piece;
+        size -= piece;
+    }
+}
+
+block_compressor::block_compressor(const output_compression &compression, const unsigned int &threads)
+    : compression(compression), slots(2 * threads), submitted(0), written(0), closing(false)
+{
+    for (unsigned int t = 0; t < threads; ++t)
+    {
+        workers.emplace_back(&block_compressor::compress_blocks, this);
+    }
+}
+
+block_compressor::~block_compressor()
+{
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        closing = true;
+    }
+    ready.notify_all();
+    for (std::thread &worker: workers)
+    {
+        worker.join();
+    }
+}
+
+void block_compressor::submit(std::string &block, const block_writer &write)
+{
+    if (block.empty())
+    {
+        return;
+    }
+    std::unique_lock<std::mutex> guard(lock);
+    while (slots[submitted % slots.size()].state != slot_state::empty)
+    {
+        if (!write_next(guard, write))
+        {
+            ready.wait(guard);
+        }
+    }
+    slot &target = slots[submitted % slots.size()];
+    target.input.swap(block);
+    target.state = slot_state::queued;
+    queued.push_back(submitted++);
+    block.clear();
+    ready.notify_all();
+}
+
+void block_compressor::finish(const block_writer &write)
+{
+    std::unique_lock<std::mutex> guard(lock);
+    while (written != submitted)
+    {
+        if (!write_next(guard, write))
+        {
+            ready.wait(guard);
+        }
+    }
+}
+
+bool block_compressor::write_next(std::unique_lock<std::mutex> &guard, const block_writer &write)
+{
+    slot &next = slots[written % slots.size()];
+    if (written == submitted || next.state != slot_state::compressed)
+    {
+        return false;
+    }
+    guard.unlock();
+    write(next.output.data(), next.output.size());
+    guard.lock();
+    next.state = slot_state::empty;
+    ++written;
+    return true;
+}
+
+// Worker thread: compresses queued blocks, oldest first, until destroyed
+void block_compressor::compress_blocks()
+{
+    block_codec codec(compression);
+    std::unique_lock<std::mutex> guard(lock);
+    for (;;)
+    {
+        ready.wait(guard, [&]() { return !queued.empty() || closing; });
+        if (queued.empty())
+        {
+            return;
+        }
+        slot &block = slots[queued.front() % slots.size()];
+        queued.pop_front();
+        guard.unlock();
+        block.output.clear();
+        codec.compress(block.input.data(), block.input.size(), block.output);
+        block.input.clear();
+        guard.lock();
+        block.state = slot_state::compressed;
+        ready.notify_all();
+    }
+}
+
+#endif
@@ -0,0 +1,126 @@
+/* block_compressor.h
+ *
+ * Copyright (C) 2018 Tyler Burdsall
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef BLOCK_COMPRESSOR_H
+#define BLOCK_COMPRESSOR_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef USE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef USE_ZSTD
+#include <zstd.h>
+#endif
+
+enum class output_compression
+{
+    none,
+    gzip,
+    zstd
+};
+
+// Largest piece of a block compressed as one gzip member or zstd frame
+const size_t                 COMPRESSION_PIECE_SIZE = 1 << 30;
+
+/*
+ * Compresses blocks independently of each other: each one becomes complete
+ * gzip members or zstd frames. Both formats define a concatenation of those
+ * as one stream, so the blocks can be compressed in any order and written
+ * back to back.
+ */
+class block_codec
+{
+public:
+    explicit block_codec(const output_compression &compression);
+    ~block_codec();
+
+    block_codec(const block_codec &) = delete;
+    block_codec &operator=(const block_codec &) = delete;
+
+    // Appends the compressed bytes to out
+    void compress(const char *bytes, size_t size, std::string &out);
+
+private:
+    output_compression              compression;
+#ifdef USE_ZLIB
+    z_stream                        deflate_stream;
+#endif
+#ifdef USE_ZSTD
+    ZSTD_CCtx                       *zstd_context;
+#endif
+};
+
+/*
+ * Compresses a sequence of blocks on several threads, pigz-style, and writes
+ * them out in the order they were submitted. A fixed ring of two slots per
+ * thread holds the blocks in flight, so memory stays bounded however far
+ * ahead the producer is: submit waits for a slot, writing out finished
+ * blocks while it does.
+ */
+class block_compressor
+{
+public:
+    typedef std::function<void(const char *, size_t)> block_writer;
+
+    block_compressor(const output_compression &compression, const unsigned int &threads);
+    ~block_compressor();
+
+    // Takes the contents of block, leaving it with a spare buffer in exchange
+    void submit(std::string &block, const block_writer &write);
+    // Writes every block submitted so far
+    void finish(const block_writer &write);
+
+private:
+    enum class slot_state
+    {
+        empty,
+        queued,
+        compressed
+    };
+
+    struct slot
+    {
+        std::string                 input;
+        std::string                 output;
+        slot_state                  state = slot_state::empty;
+    };
+
+    // Writes the oldest block if it is compressed; returns false otherwise
+    bool write_next(std::unique_lock<std::mutex> &guard, const block_writer &write);
+    void compress_blocks();
+
+    output_compression              compression;
+    std::vector<slot>               slots;
+    std::deque<unsigned long long>  queued;
+    unsigned long long              submitted;
+    unsigned long long              written;
+    bool                            closing;
+    std::mutex                      lock;
+    std::condition_variable         ready;
+    std::vector<std::thread>        workers;
+};
+
+#endif
@@ -19,7 +19,24 @@
 #ifndef CLI_FUNCTIONS_CPP
 #define CLI_FUNCTIONS_CPP
 
+#include <cstdio>
+#include <map>
 #include "cli_functions.h"
+#include "row_serializer.h"
+#include "arrow_writer.h"
+#include "input_reader.h"
+
+#if defined(WIN32) || defined(_WIN32) || defined(__WIN32) && !defined(__CYGWIN__)
+#include <fcntl.h>
+#include <io.h>
+#define open_input(path) _open(path.c_str(), _O_RDONLY | _O_BINARY)
+#define close_input(fd) _close(fd)
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#define open_input(path) ::open(path.c_str(), O_RDONLY)
+#define close_input(fd) ::close(fd)
+#endif
 
 const void display_help(void)
 {
@@ -28,159 +45,325 @@ const void display_help(void)
          << "   -a             Generates every possible combination, restricted to memory mode." << "\n"
          << "                  (Note: this should be used with caution when storing to disk)" << "\n\n"
          << "   -n <index>     Generate combination at nth index" << "\n\n"
+         << "   --from <index> Generate every combination from index (inclusive) up to the" << "\n"
+         << "   --to <index>   index given by --to (exclusive), in order. Either bound may be" << "\n"
+         << "                  omitted to start at 0 or run to the last combination; equal" << "\n"
+         << "                  bounds give an empty range. Cannot be combined with -a, -n, -r or --stream" << "\n\n"
          << "   -i <input>     Take the given .json file as input. Otherwise, input will come" << "\n"
          << "                  from stdin." << "\n"
          << "                  Example: \"{ \"foo\": [ \"a\", \"b\", \"c\" ], \"bar\": [ \"1\", \"2\" ] }\"" << "\n"
          << "                  Or:      \"[ [\"1\", \"2\"], [\"3\", \"4\", \"a\", \"b\"] ]\"" << "\n\n"
-         << "   -t <type>      Output type (csv or json). Defaults to csv" << "\n\n"
+         << "   --manifest <file>" << "\n"
+         << "                  Take plain-text columns as input instead: every line of the file" << "\n"
+         << "                  is key=path, and every line of that path is one value. Paths are" << "\n"
+         << "                  relative to the manifest and columns are sorted by key" << "\n\n"
+         << "   -t <type>      Output type (csv, json, jsonl, dict or arrow). Defaults to csv" << "\n"
+         << "                  jsonl writes one compact JSON value per line" << "\n\n"
+         << "   -t dict        Binary output: a header holding the keys and every column's" << "\n"
+         << "                  values, followed by one fixed-width record of value indices" << "\n"
+         << "                  per combination (see README for the layout)" << "\n\n"
+         << "   -t arrow       Apache Arrow IPC stream with dictionary-encoded columns" << "\n\n"
          << "   -r <size>      Generate a random sample of size r from" << "\n"
 	 << "                  the possible set of combinations" << "\n\n"
          << "   -d <delimiter> Set the delimiter when displaying combinations (default is ',')" << "\n\n"
          << "   -k             Display the keys on the first line of output (for .csv)" << "\n\n"
-         << "   -p             Use performance mode to generate combinations faster at the" << "\n"
-         << "                  expense of higher RAM usage." << "\n"
-         << "                  (Note: this is only recommended for computers with large amounts" << "\n"
-         << "                  of RAM when generating a large number of random combinations)" << "\n\n"
-         << "   -v             Display version number" << "\n";
+         << "   -p             Use performance mode for -r: rows are decoded in batches on a" << "\n"
+         << "                  second thread while the previous batch is written. The two" << "\n"
+         << "                  batches are sized to fill --max-memory, however large the sample is" << "\n\n"
+         << "   -o <path>      Write the output to the given file instead of stdout. Disk space" << "\n"
+         << "                  for the rows is reserved up front where the platform allows it" << "\n\n"
+         << "   --part-rows <n>" << "\n"
+         << "                  With -o <directory>, roll the output of -a, --from/--to, -r or" << "\n"
+         << "                  --stream over to a new part-NNNNN file every n rows. Every part" << "\n"
+         << "                  is a complete, valid file of its own" << "\n\n"
+         << "   --part-bytes <bytes>" << "\n"
+         << "                  Like --part-rows, with parts of about the given size, optionally" << "\n"
+         << "                  suffixed with K, M or G" << "\n\n"
+         << "   --partition-by <key>" << "\n"
+         << "                  With -o <directory>, write the rows of every value of the given" << "\n"
+         << "                  key to <directory>/<key>=<value>/part.<type>, each a complete" << "\n"
+         << "                  file of its own" << "\n\n"
+         << "   --compress <gzip|zstd>" << "\n"
+         << "                  Compress the output, or every -o file, with gzip or zstd. Blocks" << "\n"
+         << "                  of --buffer-size bytes are compressed on every core at once" << "\n\n"
+         << "   -v             Display version number" << "\n\n"
+         << "   --threads <n>  Use n threads when generating every combination with -a or a" << "\n"
+         << "                  random sample with -r. Output is identical to a single-threaded" << "\n"
+         << "                  run (default is 1)" << "\n\n"
+         << "   --unordered    With --threads, write blocks of rows as soon as they are ready" << "\n"
+         << "                  instead of in order. The same rows are written, in a different order" << "\n\n"
+         << "   --shard <k/N>  Only generate shard k (0-based) of N for -a or -r. Running every" << "\n"
+         << "                  shard and concatenating the outputs in order gives one complete run" << "\n\n"
+         << "   --buffer-size <bytes>" << "\n"
+         << "                  Size of the output buffer, optionally suffixed with K, M or G" << "\n"
+         << "                  (default is 1M). Two are used: one is filled while a writer" << "\n"
+         << "                  thread writes out the other" << "\n\n"
+         << "   --batch-size <rows>" << "\n"
+         << "                  Rows per record batch for -t arrow (default is 65536)" << "\n\n"
+         << "   --max-memory <bytes>" << "\n"
+         << "                  Memory for the rows -p decodes ahead of the output, and for the" << "\n"
+         << "                  buffers of --partition-by, optionally suffixed with K, M or G" << "\n"
+         << "                  (default is 64M). Every partition buffer is at least 4K, so a" << "\n"
+         << "                  key with more than --max-memory / 4K values can use more" << "\n\n"
+         << "   --seed <n>     Seed for -r. The same seed and input give the same sample," << "\n"
+         << "                  with or without -p and for any --shard split (required with --shard)" << "\n\n"
+         << "   --replace      Sample -r with replacement: each column's value is drawn on its" << "\n"
+         << "                  own, so rows may repeat and r may exceed the number of combinations" << "\n\n"
+         << "   --stream       Write rows drawn with replacement until interrupted, in place of" << "\n"
+         << "                  -a, -n, -r or --from/--to" << "\n";
 }
 
 
-const void display_csv_keys(const vector<string> &keys, const string &delim)
+static void append_csv_keys(const vector<string> &keys, const string &delim, string &out)
 {
     for (auto& s: keys)
     {
-        if (&s == &keys.back())
-        {
-            cout << s;
-        }
-        else
+        append_csv_field(s, delim, out);
+        if (&s != &keys.back())
         {
-            cout << s << delim;
+            out += delim;
         }
     }
-    cout << '\n';
+    out += '\n';
+}
+
+const void display_csv_keys(const vector<string> &keys, const string &delim, output_writer &out)
+{
+    append_csv_keys(keys, delim, out.buffer());
+    out.commit();
 }
 
-const void output_result(const vector<string> &result, const generation_args &args, const bool &for_optimization)
+// Framing written before the first and after the last row of a complete run
+const void append_output_header(const generation_args &args, string &out)
 {
-    if (!args.display_json)
+    if (args.type == output_type::csv)
     {
-        if (args.display_keys && !for_optimization)
+        if (args.display_keys)
         {
-            display_csv_keys(args.pc.keys, args.delim);
+            append_csv_keys(args.pc.keys, args.delim, out);
         }
-        for (auto &s: result)
-        {
-            if (&s == &result.back())
-            {
-                cout << s;
-            }
-            else
-            {
-                cout << s << args.delim;
-            }
-        }
-        cout << "\n";
+    }
+    else if (args.type == output_type::json)
+    {
+        out += "[\n";
+    }
+    else if (args.type == output_type::dict)
+    {
+        append_dict_header(args, out);
+    }
+    else if (args.type == output_type::arrow)
+    {
+        append_arrow_schema(args, out);
+    }
+}
+
+const void append_output_footer(const generation_args &args, string &out)
+{
+    if (args.type == output_type::json)
+    {
+        out += "]\n";
+    }
+    else if (args.type == output_type::arrow)
+    {
+        append_arrow_end_of_stream(out);
+    }
+}
+
+// With --part-rows or --partition-by every file carries its own framing instead
+const void output_header(const generation_args &args, output_writer &out)
+{
+    if (args.shard_index == 0 && args.part_rows == 0 && args.partition_by.empty())
+    {
+        append_output_header(args, out.buffer());
+        out.commit();
+    }
+}
+
+const void output_footer(const generation_args &args, output_writer &out)
+{
+    if (args.shard_index == args.shard_count - 1 && args.part_rows == 0 && args.partition_by.empty())
+    {
+        append_output_footer(args, out.buffer());
+        out.commit();
+    }
+}
+
+// File name extension of the output type, followed by that of the compression
+const string output_extension(const generation_args &args)
+{
+    static const char *extensions[] = { "csv", "json", "jsonl", "dict", "arrow" };
+    static const char *compressions[] = { "", ".gz", ".zst" };
+    return string(extensions[static_cast<int>(args.type)]) + compressions[static_cast<int>(args.compression)];
+}
+
+// <-o>/part-NNNNN.<type>, or part-<shard>-NNNNN.<type> when sharded
+static string part_path(const generation_args &args, const unsigned long long &part)
+{
+    char name[64];
+    if (args.shard_count > 1)
+    {
+        snprintf(name, sizeof(name), "part-%05llu-%05llu.", args.shard_index, part);
     }
     else
     {
-        const unsigned long long key_size = args.pc.keys.size();
-        if (!for_optimization) 
-        {
-            cout << "[\n";
-        }
-        if (key_size == 0)
-        {
-            json entry = json::array();
-            for (const string& s : result)
-            {
-                entry.push_back(s);
-            }
-            cout << entry.dump(4);
-        }
-        else
-        {
-            json entry;
-            for (unsigned long long j = 0; j < key_size; ++j)
-            {
-                entry[args.pc.keys[j]] = result[j];
-            }
-            cout << entry.dump(4);
-        }
-        if (!for_optimization)
-        {
-            cout << "]\n";
-        }
+        snprintf(name, sizeof(name), "part-%05llu.", part);
     }
+    return args.output + "/" + name + output_extension(args);
 }
 
-const possible_combinations parse_file(const string &input)
+// Starts the given part in a file of its own, with a complete header
+const void output_part_begin(const generation_args &args, const unsigned long long &part, output_writer &out)
+{
+    out.open_file(part_path(args, part));
+    append_output_header(args, out.buffer());
+    out.commit();
+}
+
+const void output_part_end(const generation_args &args, output_writer &out)
+{
+    append_output_footer(args, out.buffer());
+    out.flush();
+}
+
+const void output_result(const combination_iterator &row, const generation_args &args, const bool &for_optimization, output_writer &out)
+{
+    row_serializer serializer(args);
+    string &buffer = out.buffer();
+    if (!for_optimization)
+    {
+        append_output_header(args, buffer);
+    }
+    serializer.append(row, buffer);
+    serializer.finish(buffer);
+    if (!for_optimization)
+    {
+        append_output_footer(args, buffer);
+    }
+    out.commit();
+}
+
+possible_combinations parse_file(const string &input)
 {
     possible_combinations pc;
+    const int fd = open_input(input);
+    if (fd < 0)
+    {
+        cerr << "ERROR: Couldn't parse the given file, please ensure the file is in valid .json format and is accessible." << '\n';
+        exit(-1);
+    }
     try
     {
-        ifstream i(input);
-        json json_file;
-        i >> json_file;
-
-        if (json_file.type() == json::value_t::array)
-        {
-            for (json::iterator arr = json_file.begin(); arr != json_file.end(); ++arr)
-            {
-                pc.combinations.push_back(arr.value());
-            }
-        }
-        else
-        {
-            for (auto obj = json_file.begin(); obj != json_file.end(); ++obj)
-            {
-                pc.keys.push_back(obj.key());
-                pc.combinations.push_back(obj.value());
-            }
-        }
+        pc = parse_combinations(std::make_shared<const mapped_input>(fd));
     }
-    catch (const nlohmann::detail::parse_error&)
+    catch (const input_parse_error&)
     {
         cerr << "ERROR: Couldn't parse the given file, please ensure the file is in valid .json format and is accessible." << '\n';
         exit(-1);
     }
-    catch (const nlohmann::detail::type_error&)
+    catch (const input_type_error&)
     {
         cerr << "ERROR: All values in input must be an array containing strings" << '\n';
         exit(-1);
     }
+    close_input(fd);
     return pc;
 }
 
-const possible_combinations parse_stdin(const string &input)
+// Every value ends up in JSON output, so each line has to be valid UTF-8
+static void check_lines_utf8(const string &path, const value_column &lines)
+{
+    for (size_t i = 0; i < lines.size(); ++i)
+    {
+        if (find_invalid_utf8(lines[i].begin(), lines[i].end()) != lines[i].end())
+        {
+            cerr << "ERROR: " << path << " line " << i + 1 << " is not valid UTF-8, please convert the file to UTF-8" << '\n';
+            exit(-1);
+        }
+    }
+}
+
+// Opens path, relative to the manifest's directory unless it is absolute
+static int open_manifest_entry(const string &manifest, const string &path)
+{
+    const bool absolute = !path.empty() && (path[0] == '/' || path[0] == '\\' || (path.size() > 1 && path[1] == ':'));
+    const size_t slash = manifest.find_last_of("/\\");
+    if (absolute || slash == string::npos)
+    {
+        return open_input(path);
+    }
+    return open_input(string(manifest.substr(0, slash + 1) + path));
+}
+
+/*
+ * Each non-empty manifest line is key=path, split at the first '='; lines
+ * starting with '#' are comments. Every line of a listed file is one value,
+ * referenced in place in the mapped file. Columns are sorted by key and a
+ * repeated key keeps its last file, like a JSON object input, so a manifest
+ * and the equivalent .json file give the same combination at every index.
+ */
+possible_combinations parse_manifest(const string &input)
 {
     possible_combinations pc;
-    try
+    const int fd = open_input(input);
+    if (fd < 0)
+    {
+        cerr << "ERROR: Couldn't read the given manifest, please ensure it is accessible." << '\n';
+        exit(-1);
+    }
+    value_column lines;
+    const mapped_input manifest(fd);
+    close_input(fd);
+    append_lines(manifest, lines);
+    check_lines_utf8(input, lines);
+    std::map<string, std::pair<string, std::shared_ptr<const mapped_input>>> files;
+    for (const value_view &line: lines)
     {
-        auto parsed = json::parse(input);
-        if (parsed.type() == json::value_t::array)
+        if (line.size == 0 || line.data[0] == '#')
         {
-            for (json::iterator arr = parsed.begin(); arr != parsed.end(); ++arr)
-            {
-                pc.combinations.push_back(arr.value());
-            }
+            continue;
         }
-        else
+        const string entry = line.str();
+        const size_t equals = entry.find('=');
+        if (equals == 0 || equals == string::npos || equals + 1 == entry.size())
         {
-            for (auto obj = parsed.begin(); obj != parsed.end(); ++obj)
-            {
-                pc.keys.push_back(obj.key());
-                pc.combinations.push_back(obj.value());
-            }
+            cerr << "ERROR: Every manifest line must have the form key=path, found: " << entry << '\n';
+            exit(-1);
         }
-        
+        const string path = entry.substr(equals + 1);
+        const int column_fd = open_manifest_entry(input, path);
+        if (column_fd < 0)
+        {
+            cerr << "ERROR: Couldn't read " << path << " from the manifest, please ensure it is accessible." << '\n';
+            exit(-1);
+        }
+        files[entry.substr(0, equals)] = std::make_pair(path, std::make_shared<const mapped_input>(column_fd));
+        close_input(column_fd);
+    }
+    for (const auto &file: files)
+    {
+        value_column values;
+        append_lines(*file.second.second, values);
+        check_lines_utf8(file.second.first, values);
+        pc.keys.push_back(file.first);
+        pc.combinations.append_column(std::move(values));
+        pc.combinations.keep(file.second.second);
+    }
+    return pc;
+}
+
+possible_combinations parse_stdin(void)
+{
+    possible_combinations pc;
+    try
+    {
+        pc = parse_combinations(std::make_shared<const mapped_input>(STANDARD_INPUT_FD));
     }
-    catch (const nlohmann::detail::type_error&)
+    catch (const input_type_error&)
     {
         cerr << "ERROR: All values in input must be an array containing strings" << '\n';
         exit(-1);
     }
-    catch (const nlohmann::detail::parse_error&)
+    catch (const input_parse_error&)
     {
         cerr << "ERROR: Unable to parse the given input, please ensure a valid .json input has been provided" << '\n';
         exit(-1);
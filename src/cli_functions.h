@@ -21,9 +21,17 @@
 
 #include "combigen.h"
 
-const void                   display_csv_keys(const vector<string> &keys, const string &delim);
+const void                   append_output_header(const generation_args &args, string &out);
+const void                   append_output_footer(const generation_args &args, string &out);
+const void                   display_csv_keys(const vector<string> &keys, const string &delim, output_writer &out);
 const void                   display_help(void);
-const void                   output_result(const vector<string> &result, const generation_args &args, const bool &for_optimization);
-const possible_combinations  parse_file(const string &input);
-const possible_combinations  parse_stdin(const string &input);
+const void                   output_header(const generation_args &args, output_writer &out);
+const void                   output_footer(const generation_args &args, output_writer &out);
+const void                   output_part_begin(const generation_args &args, const unsigned long long &part, output_writer &out);
+const void                   output_part_end(const generation_args &args, output_writer &out);
+const string                 output_extension(const generation_args &args);
+const void                   output_result(const combination_iterator &row, const generation_args &args, const bool &for_optimization, output_writer &out);
+possible_combinations        parse_file(const string &input);
+possible_combinations        parse_manifest(const string &input);
+possible_combinations        parse_stdin(void);
 #endif
@@ -21,138 +21,188 @@
 
 #include "combigen.h"
 #include "cli_functions.h"
+#include "parallel_generation.h"
+#include "index_permutation.h"
 
-const void generate_random_samples_performance_mode(const generation_args &args)
+/*
+ * Parses a decimal index into value. Returns false when the text is not a
+ * number or does not fit in Index, i.e. when it is beyond any product that
+ * Index was chosen for.
+ */
+template <typename Index>
+static bool parse_index(const string &text, Index &value)
 {
-    unsigned long long sample_size = stoull(args.sample_size, 0, 10);
-    const vector<vector<string>> results = lazy_cartesian_product::generate_samples(args.pc.combinations, sample_size);
-    if (!args.display_json)
-    {
-        if (args.display_keys)
-        {
-            display_csv_keys(args.pc.keys, args.delim);
-        }
-    }
-    else
+    const Index max_value = ~Index(0);
+    value = 0;
+    if (text.empty() || text.find_first_not_of("0123456789") != string::npos)
     {
-        cout << "[\n";
+        return false;
     }
-    for( const vector<string> &row: results)
+    for (const char &c: text)
     {
-        output_result(row, args, true);
-        if (args.display_json && &row != &results.back())
+        const unsigned int digit = c - '0';
+        if (value > (max_value - digit) / 10)
         {
-            cout << ",";
+            return false;
         }
+        value = value * 10 + digit;
     }
-    if (args.display_json)
-    {
-        cout << "]\n";
-    }
+    return true;
 }
 
-
-const void parse_args(const generation_args &args)
+// Multiplies the column sizes into size. Returns false if the product does not fit in Index.
+template <typename Index>
+static bool product_size(const value_table &combinations, Index &size)
 {
-    const unsigned long long max_size = lazy_cartesian_product::compute_max_size(args.pc.combinations);
-    if (args.generate_all_combinations)
+    const Index max_value = ~Index(0);
+    size = 1;
+    for (const value_column &values: combinations)
     {
-        generate_all(max_size, args);
-        exit(0);
-    }
-    else
-    {
-        const unsigned long long sample_size = stoull(args.sample_size, 0, 10);
-        if (sample_size == 0 && args.entry_at_provided && !args.generate_all_combinations)
-        {
-            const unsigned long long entry_at = stoull(args.entry_at, 0, 10);
-            vector<string> result = lazy_cartesian_product::entry_at(args.pc.combinations, entry_at);
-            output_result(result, args, false);
-            exit(0);
-        }
-        else if (sample_size >= 0)
+        if (values.empty())
         {
-            const unsigned long long n = stoull(args.sample_size, 0, 10);
-            if (n > max_size)
-            {
-                cerr << "ERROR: Sample size cannot be greater than maximum possible combinations\n";
-                exit(-1);
-            }
-            if (args.perf_mode)
-            {
-                generate_random_samples_performance_mode(args);
-            }
-            else
-            {
-                generate_random_samples(max_size, args);
-            }
-            exit(0);
+            throw lazycp::errors::empty_list_error();
         }
-        else
+        if (size > max_value / values.size())
         {
-            display_help();
-            exit(-1);
+            return false;
         }
+        size *= values.size();
     }
+    return true;
 }
 
+template <typename Index>
+const void generate_random_samples_performance_mode(const Index &max_size, const generation_args &args, output_writer &out)
+{
+    // Same permutation and positions as generate_random_samples, decoded a batch ahead
+    Index sample_size;
+    parse_index(args.sample_size, sample_size);
+    output_header(args, out);
+    generate_sample_pipeline(max_size, sample_size, args, out);
+    output_footer(args, out);
+}
 
-const void generate_all(const unsigned long long &max_size, const generation_args &args)
+// Everything after the product size is known, with indices of type Index
+template <typename Index>
+const void generate(const Index &max_size, const generation_args &args, output_writer &out)
 {
-    if (!args.display_json)
+    if (args.generate_all_combinations)
     {
-        if (args.display_keys)
-        {
-            display_csv_keys(args.pc.keys, args.delim);
-        }
+        generate_all(max_size, args, out);
+        return;
     }
-    else
+    else if (args.range_provided)
     {
-        cout << "[\n";
+        generate_range(max_size, args, out);
+        return;
     }
-    const unsigned long long last = max_size - 1;
-    for (unsigned long long i = 0; i < max_size; ++i)
+    Index sample_size;
+    const bool sample_fits = parse_index(args.sample_size, sample_size);
+    if (sample_fits && sample_size == 0 && args.entry_at_provided)
     {
-        vector<string> result = lazy_cartesian_product::entry_at(args.pc.combinations, i);
-        output_result(result, args, true);
-        if (args.display_json && i != last)
+        Index entry_at;
+        if (!parse_index(args.entry_at, entry_at) || entry_at >= max_size)
         {
-            cout << ",";
+            throw lazycp::errors::index_error();
         }
+        combination_iterator row(args.pc.combinations);
+        row.seek(entry_at);
+        output_result(row, args, false, out);
+        return;
+    }
+    if (!sample_fits || sample_size > max_size)
+    {
+        cerr << "ERROR: Sample size cannot be greater than maximum possible combinations\n";
+        exit(-1);
+    }
+    if (args.perf_mode && args.threads == 1)
+    {
+        generate_random_samples_performance_mode(max_size, args, out);
     }
-    if (args.display_json)
+    else
     {
-        cout << "]\n";
+        generate_random_samples(max_size, args, out);
     }
 }
 
-const void generate_random_samples(const unsigned long long &max_size, const generation_args &args)
+/*
+ * Picks the narrowest index type that holds the number of combinations:
+ * 64-bit, then 128-bit where the compiler has it, then uint1024_t in Boost
+ * builds. Small products never pay for wide arithmetic.
+ */
+const void parse_args(const generation_args &args, output_writer &out)
 {
-    if (!args.display_json)
+    if (!args.generate_all_combinations && !args.range_provided && (args.with_replacement || args.stream))
     {
-        if (args.display_keys)
+        // Drawn column by column, before the product size is ever computed
+        unsigned long long sample_size = STREAM_ROWS;
+        if (!args.stream && !parse_index(args.sample_size, sample_size))
         {
-            display_csv_keys(args.pc.keys, args.delim);
+            cerr << "ERROR: Sample size cannot be greater than maximum possible combinations\n";
+            exit(-1);
         }
+        output_header(args, out);
+        generate_draw_shard(sample_size, args, out);
+        output_footer(args, out);
+        return;
     }
-    else
+    unsigned long long size_64;
+    if (product_size(args.pc.combinations, size_64))
     {
-        cout << "[\n";
+        generate(size_64, args, out);
+        return;
     }
-    unsigned long long parsed_sample_size = stoull(args.sample_size, 0, 10);
-    lazycp::RandomIterator iter(parsed_sample_size, max_size - 1);
-    while (iter.has_next())
+#ifdef __SIZEOF_INT128__
+    unsigned __int128 size_128;
+    if (product_size(args.pc.combinations, size_128))
     {
-        vector<string> result = lazy_cartesian_product::entry_at(args.pc.combinations, iter.next());
-        output_result(result, args, true);
-        if (args.display_json && iter.has_next())
-        {
-            cout << ",";
-        }
+        generate(size_128, args, out);
+        return;
     }
-    if (args.display_json)
+#endif
+#ifdef USE_BOOST
+    uint1024_t size_1024;
+    if (product_size(args.pc.combinations, size_1024))
     {
-        cout << "]\n";
+        generate(size_1024, args, out);
+        return;
     }
+#endif
+    cerr << "ERROR: the number of possible combinations is too large for this build\n";
+    exit(-1);
+}
+
+
+template <typename Index>
+const void generate_all(const Index &max_size, const generation_args &args, output_writer &out)
+{
+    output_header(args, out);
+    generate_shard<Index>(0, max_size, args, out);
+    output_footer(args, out);
+}
+
+template <typename Index>
+const void generate_range(const Index &max_size, const generation_args &args, output_writer &out)
+{
+    Index from, to = max_size;
+    if (!parse_index(args.range_from, from) || (!args.range_to.empty() && !parse_index(args.range_to, to))
+        || from > to || to > max_size)
+    {
+        cerr << "ERROR: Range must satisfy from <= to <= maximum possible combinations\n";
+        exit(-1);
+    }
+    output_header(args, out);
+    generate_shard(from, to, args, out);
+    output_footer(args, out);
+}
+
+template <typename Index>
+const void generate_random_samples(const Index &max_size, const generation_args &args, output_writer &out)
+{
+    Index sample_size;
+    parse_index(args.sample_size, sample_size);
+    output_header(args, out);
+    generate_sample_shard(max_size, sample_size, args, out);
+    output_footer(args, out);
 }
 #endif
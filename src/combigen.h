@@ -29,11 +29,15 @@
 #include <sstream>
 #include "lib/nlohmann/json/single_include/nlohmann/json.hpp"
 #include "lib/iamtheburd/lazy-cartesian-product/lazy-cartesian-product.hpp"
+#include "value_table.h"
+#include "combination_iterator.h"
+#include "output_writer.h"
 
 #ifndef USE_BOOST
 using std::stoull;
 #endif
 
+using std::stoul;
 using std::cout;
 using std::cin;
 using std::cerr;
@@ -49,32 +53,81 @@ using json = nlohmann::json;
 struct possible_combinations
 {
     vector<string>                  keys;
-    vector<vector<string>>          combinations;
+    value_table                     combinations;
+};
+
+// Rows per Arrow record batch
+const size_t                 DEFAULT_BATCH_SIZE = 65536;
+// Memory for the rows -p decodes ahead of the output
+const size_t                 DEFAULT_MAX_MEMORY = 64 << 20;
+// Rows written by --stream: more than a century at a billion rows per second
+const unsigned long long     STREAM_ROWS = 1ULL << 62;
+
+enum class output_type
+{
+    csv,
+    json,
+    jsonl,
+    dict,
+    arrow
+};
+
+// Every possible value pre-rendered for output, built once by compile_fragments
+struct row_fragments
+{
+    string                          row_prefix;
+    value_table                     columns;
+    // Mean bytes per row, used to size parts and preallocate -o files
+    double                          mean_row_size = 0;
 };
 
 struct generation_args
 {
     possible_combinations           pc;
+    row_fragments                   fragments;
     string                          input;
+    string                          manifest;
+    string                          output;
+    string                          partition_by;
     string                          delim = ",";
     string                          entry_at = "0";
     string                          sample_size = "0";
+    string                          range_from = "0";
+    string                          range_to;
     bool                            generate_all_combinations = false;
     bool                            display_keys = false;
-    bool                            display_json = false;
+    output_type                     type = output_type::csv;
+    output_compression              compression = output_compression::none;
     bool                            perf_mode = false;
     bool	                    entry_at_provided = false;
+    bool                            range_provided = false;
+    bool                            unordered = false;
+    bool                            with_replacement = false;
+    bool                            stream = false;
+    unsigned int                    threads = 1;
+    size_t                          buffer_size = DEFAULT_OUTPUT_BUFFER_SIZE;
+    size_t                          batch_size = DEFAULT_BATCH_SIZE;
+    size_t                          max_memory = DEFAULT_MAX_MEMORY;
+    unsigned long long              part_rows = 0;
+    size_t                          part_bytes = 0;
+    size_t                          partition_column = 0;
+    // Partition of each value of the --partition-by column; equal values share one
+    vector<size_t>                  partition_ids;
+    unsigned long long              shard_index = 0;
+    unsigned long long              shard_count = 1;
+    unsigned long long              seed = 0;
+    bool                            seed_provided = false;
 };
 
-#ifdef USE_BOOST
-const void                   generate_all(const uint1024_t &max_size, const generation_args &args);
-const void                   generate_random_samples(const uint1024_t &max_size, const generation_args &args);
-#else
-const void                   generate_all(const unsigned long long &max_size, const generation_args &args);
-const void                   generate_random_samples(const unsigned long long &max_size, const generation_args &args);
-#endif
-const void                   generate_random_samples_performance_mode(const generation_args &args);
-const void                   generate_random_samples_memory_mode(const generation_args &args);
-const void                   parse_args(const generation_args &args);
+template <typename Index>
+const void                   generate_all(const Index &max_size, const generation_args &args, output_writer &out);
+template <typename Index>
+const void                   generate_range(const Index &max_size, const generation_args &args, output_writer &out);
+template <typename Index>
+const void                   generate_random_samples(const Index &max_size, const generation_args &args, output_writer &out);
+template <typename Index>
+const void                   generate_random_samples_performance_mode(const Index &max_size, const generation_args &args, output_writer &out);
+const void                   generate_random_samples_memory_mode(const generation_args &args, output_writer &out);
+const void                   parse_args(const generation_args &args, output_writer &out);
 
 #endif
@@ -0,0 +1,135 @@
+/* combination_iterator.h
+ *
+ * Copyright (C) 2018 Tyler Burdsall
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef COMBINATION_ITERATOR_H
+#define COMBINATION_ITERATOR_H
+
+#include <climits>
+#include <cstddef>
+#include <vector>
+#include "value_table.h"
+
+using std::size_t;
+
+/*
+ * Walks the cartesian product in the same order as lazy_cartesian_product::entry_at,
+ * keeping one digit per column and advancing them like an odometer (the last column
+ * changes fastest). Values are handed out as views into the value_table, so emitting
+ * a row never copies the strings or repeats the mixed-radix decode.
+ */
+class combination_iterator
+{
+public:
+    explicit combination_iterator(const value_table &combinations)
+        : combinations(combinations), digits(combinations.size(), 0), changed(0)
+    {
+        // Groups trailing columns while the product of their sizes fits in 64 bits
+        unsigned long long product = 1;
+        for (size_t column = digits.size(); column > 0; --column)
+        {
+            const unsigned long long radix = combinations[column - 1].size();
+            if (radix > 0 && product > ULLONG_MAX / radix)
+            {
+                group_starts.push_back(column);
+                group_radices.push_back(product);
+                product = 1;
+            }
+            product *= radix;
+        }
+        group_starts.push_back(0);
+        group_radices.push_back(product);
+    }
+
+    // Positions the iterator on the combination at the given index, decoding it once.
+    // The index is divided once per group of columns, and the 64-bit remainder is
+    // split into that group's digits natively, so a multiprecision index costs one
+    // big division per 64 bits of product instead of one per column. Works for any
+    // unsigned index type.
+    template <typename Index>
+    void seek(Index index)
+    {
+        size_t column = digits.size();
+        for (size_t group = 0; group < group_radices.size(); ++group)
+        {
+            // One division; the remainder comes from a cheap multiply-subtract
+            const unsigned long long radix = group_radices[group];
+            const Index quotient = index / radix;
+            unsigned long long rest = static_cast<unsigned long long>(Index(index - quotient * radix));
+            index = quotient;
+            for (; column > group_starts[group]; --column)
+            {
+                const size_t column_radix = combinations[column - 1].size();
+                digits[column - 1] = static_cast<size_t>(rest % column_radix);
+                rest /= column_radix;
+            }
+        }
+        changed = 0;
+    }
+
+    // Moves to the next combination. Returns false once every combination has been
+    // visited, at which point the iterator has wrapped back around to index 0.
+    bool next()
+    {
+        size_t column = digits.size();
+        while (column > 0)
+        {
+            --column;
+            if (++digits[column] < combinations[column].size())
+            {
+                changed = column;
+                return true;
+            }
+            digits[column] = 0;
+        }
+        changed = 0;
+        return false;
+    }
+
+    const value_view &operator[](const size_t &column) const
+    {
+        return combinations[column][digits[column]];
+    }
+
+    size_t size() const
+    {
+        return digits.size();
+    }
+
+    // Lowest column modified by the last call to next(); every column before it is
+    // unchanged from the previous row.
+    size_t first_changed() const
+    {
+        return changed;
+    }
+
+    const std::vector<size_t> &current_digits() const
+    {
+        return digits;
+    }
+
+private:
+    const value_table                            &combinations;
+    std::vector<size_t>                          digits;
+    // Column groups for seek, last group first: group g covers the columns from
+    // group_starts[g] up to the start of group g - 1
+    std::vector<size_t>                          group_starts;
+    std::vector<unsigned long long>              group_radices;
+    size_t                                       changed;
+};
+
+#endif
@@ -0,0 +1,69 @@
+/* file_io.h
+ *
+ * Copyright (C) 2018 Tyler Burdsall
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FILE_IO_H
+#define FILE_IO_H
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdlib>
+#include <iostream>
+
+// Raw file descriptor calls for writing output files, on POSIX and Windows
+#if defined(WIN32) || defined(_WIN32) || defined(__WIN32) && !defined(__CYGWIN__)
+#include <direct.h>
+#include <fcntl.h>
+#include <io.h>
+#include <sys/stat.h>
+#define write_fd(fd, bytes, size) _write(fd, bytes, static_cast<unsigned int>(size))
+#define open_output(path) _open(path.c_str(), _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY, _S_IREAD | _S_IWRITE)
+#define open_append(path) _open(path.c_str(), _O_WRONLY | _O_APPEND | _O_BINARY)
+#define close_fd(fd) _close(fd)
+#define make_directory(path) _mkdir(path)
+#else
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#define write_fd(fd, bytes, size) ::write(fd, bytes, size)
+#define open_output(path) ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644)
+#define open_append(path) ::open(path.c_str(), O_WRONLY | O_APPEND)
+#define close_fd(fd) ::close(fd)
+#define make_directory(path) mkdir(path, 0755)
+#endif
+
+// Writes all size bytes to fd, retrying short and interrupted writes; any other failure ends the program
+inline void write_fully(const int &fd, const char *bytes, std::size_t size)
+{
+    while (size > 0)
+    {
+        const auto written = write_fd(fd, bytes, size);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            std::cerr << "ERROR: Unable to write output\n";
+            exit(-1);
+        }
+        bytes += written;
+        size -= static_cast<std::size_t>(written);
+    }
+}
+
+#endif
@@ -0,0 +1,187 @@
+/* index_permutation.h
+ *
+ * Copyright (C) 2018 Tyler Burdsall
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef INDEX_PERMUTATION_H
+#define INDEX_PERMUTATION_H
+
+#include <algorithm>
+#include <cstddef>
+#include <random>
+#include <vector>
+
+using std::size_t;
+
+const size_t                 FEISTEL_ROUNDS = 6;
+// Limbs per Feistel half: 512 bits, enough for a 1024-bit index
+const size_t                 PERMUTATION_HALF_LIMBS = 8;
+
+// Weyl sequence increment of splitmix64
+const unsigned long long     SPLITMIX_GAMMA = 0x9E3779B97F4A7C15ULL;
+
+// splitmix64 output for the state value, used both for the key schedule and the round function
+inline unsigned long long mix_bits(unsigned long long value)
+{
+    value += SPLITMIX_GAMMA;
+    value = (value ^ (value >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    value = (value ^ (value >> 27)) * 0x94D049BB133111EBULL;
+    return value ^ (value >> 31);
+}
+
+inline unsigned long long random_permutation_seed()
+{
+    std::random_device device;
+    return (static_cast<unsigned long long>(device()) << 32) ^ device();
+}
+
+/*
+ * A keyed pseudo-random permutation of [0, size): a balanced Feistel network
+ * over the smallest even number of bits that covers size - 1, with cycle
+ * walking to stay inside [0, size). That domain is less than 4 * size, so
+ * at(position) takes fewer than four encryptions on average and no state is
+ * kept between calls: reading positions 0, 1, 2, ... yields distinct indices
+ * in random order, and any position can be read first. Works for any unsigned
+ * index type that supports shifts and masks, up to 1024 bits.
+ *
+ * The rounds run on the halves as arrays of 64-bit limbs, so a wide Index is
+ * only split and joined once per call instead of once per round.
+ */
+template <typename Index>
+class index_permutation
+{
+public:
+    index_permutation(const Index &size, const unsigned long long &seed)
+        : half_bits(1), limbs(1), top_mask(1), round_keys(FEISTEL_ROUNDS)
+    {
+        const Index last = size > 0 ? Index(size - 1) : Index(0);
+        size_t bits = 0;
+        for (Index rest = last; rest > 0; rest >>= 1)
+        {
+            ++bits;
+        }
+        if (bits > 2)
+        {
+            half_bits = (bits + 1) / 2;
+        }
+        limbs = (half_bits + 63) / 64;
+        top_mask = half_bits % 64 == 0 ? ~0ULL : (1ULL << (half_bits % 64)) - 1;
+        half_mask = (Index(1) << half_bits) - 1;
+        split(last, last_left, last_right);
+        unsigned long long state = seed;
+        for (unsigned long long &key: round_keys)
+        {
+            state = mix_bits(state);
+            key = state;
+        }
+    }
+
+    // The index at the given position, for any position < size
+    Index at(const Index &position) const
+    {
+        unsigned long long left[PERMUTATION_HALF_LIMBS];
+        unsigned long long right[PERMUTATION_HALF_LIMBS];
+        split(position, left, right);
+        do
+        {
+            encrypt(left, right);
+        }
+        while (above_last(left, right));
+        return Index(from_limbs(left) << half_bits) | from_limbs(right);
+    }
+
+private:
+    void encrypt(unsigned long long *left, unsigned long long *right) const
+    {
+        for (const unsigned long long &key: round_keys)
+        {
+            round(right, key, left);
+            std::swap_ranges(left, left + limbs, right);
+        }
+    }
+
+    // Folds the half into one word, then expands that word back to half_bits
+    // and XORs it into target
+    void round(const unsigned long long *half, const unsigned long long &key, unsigned long long *target) const
+    {
+        unsigned long long state = key;
+        for (size_t l = 0; l < limbs; ++l)
+        {
+            state = mix_bits(state ^ half[l]);
+        }
+        for (size_t l = 0; l < limbs; ++l)
+        {
+            target[l] ^= mix_bits(state + l);
+        }
+        target[limbs - 1] &= top_mask;
+    }
+
+    bool above_last(const unsigned long long *left, const unsigned long long *right) const
+    {
+        for (size_t l = limbs; l > 0; --l)
+        {
+            if (left[l - 1] != last_left[l - 1])
+            {
+                return left[l - 1] > last_left[l - 1];
+            }
+        }
+        for (size_t l = limbs; l > 0; --l)
+        {
+            if (right[l - 1] != last_right[l - 1])
+            {
+                return right[l - 1] > last_right[l - 1];
+            }
+        }
+        return false;
+    }
+
+    void split(const Index &value, unsigned long long *left, unsigned long long *right) const
+    {
+        to_limbs(Index(value >> half_bits), left);
+        to_limbs(Index(value & half_mask), right);
+    }
+
+    // Limb shifts use a runtime amount so that a 64-bit Index, which only ever
+    // has one limb, never sees a shift by its width
+    void to_limbs(const Index &half, unsigned long long *out) const
+    {
+        const Index limb_mask = Index(~0ULL);
+        for (size_t l = 0; l < limbs; ++l)
+        {
+            out[l] = static_cast<unsigned long long>(Index((half >> (64 * l)) & limb_mask));
+        }
+    }
+
+    Index from_limbs(const unsigned long long *half) const
+    {
+        Index result = 0;
+        for (size_t l = 0; l < limbs; ++l)
+        {
+            result |= Index(half[l]) << (64 * l);
+        }
+        return result;
+    }
+
+    size_t                          half_bits;
+    size_t                          limbs;
+    unsigned long long              top_mask;
+    Index                           half_mask;
+    unsigned long long              last_left[PERMUTATION_HALF_LIMBS];
+    unsigned long long              last_right[PERMUTATION_HALF_LIMBS];
+    std::vector<unsigned long long> round_keys;
+};
+
+#endif
@@ -0,0 +1,479 @@
+/* input_reader.cpp
+ *
+ * Copyright (C) 2018 Tyler Burdsall
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef INPUT_READER_CPP
+#define INPUT_READER_CPP
+
+#include <cstring>
+#include <map>
+#include "input_reader.h"
+
+#if defined(WIN32) || defined(_WIN32) || defined(__WIN32) && !defined(__CYGWIN__)
+#include <io.h>
+#define read_fd(fd, bytes, size) _read(fd, bytes, static_cast<unsigned int>(size))
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define read_fd(fd, bytes, size) ::read(fd, bytes, size)
+#define HAVE_MMAP
+#endif
+
+const size_t                 INPUT_READ_SIZE = 1 << 16;
+
+// Length of the well-formed UTF-8 sequence starting a non-ASCII byte at, or 0
+static size_t utf8_sequence_length(const unsigned char *at, const unsigned char *end)
+{
+    size_t length;
+    unsigned char low = 0x80, high = 0xBF;
+    if (at[0] >= 0xC2 && at[0] <= 0xDF)
+    {
+        length = 2;
+    }
+    else if (at[0] >= 0xE0 && at[0] <= 0xEF)
+    {
+        length = 3;
+        // No overlong forms and no UTF-16 surrogates
+        low = at[0] == 0xE0 ? 0xA0 : 0x80;
+        high = at[0] == 0xED ? 0x9F : 0xBF;
+    }
+    else if (at[0] >= 0xF0 && at[0] <= 0xF4)
+    {
+        length = 4;
+        // No overlong forms and nothing past U+10FFFF
+        low = at[0] == 0xF0 ? 0x90 : 0x80;
+        high = at[0] == 0xF4 ? 0x8F : 0xBF;
+    }
+    else
+    {
+        return 0;
+    }
+    if (static_cast<size_t>(end - at) < length || at[1] < low || at[1] > high)
+    {
+        return 0;
+    }
+    for (size_t i = 2; i < length; ++i)
+    {
+        if (at[i] < 0x80 || at[i] > 0xBF)
+        {
+            return 0;
+        }
+    }
+    return length;
+}
+
+const char *find_invalid_utf8(const char *begin, const char *end)
+{
+    const unsigned char *at = reinterpret_cast<const unsigned char*>(begin);
+    const unsigned char *last = reinterpret_cast<const unsigned char*>(end);
+    while (at != last)
+    {
+        if (*at < 0x80)
+        {
+            ++at;
+            continue;
+        }
+        const size_t length = utf8_sequence_length(at, last);
+        if (length == 0)
+        {
+            break;
+        }
+        at += length;
+    }
+    return reinterpret_cast<const char*>(at);
+}
+
+mapped_input::mapped_input(const int &fd)
+    : first(nullptr), length(0), mapping(nullptr)
+{
+#ifdef HAVE_MMAP
+    struct stat info;
+    if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0)
+    {
+        void *view = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        if (view != MAP_FAILED)
+        {
+            // Values are read front to back exactly once
+            madvise(view, static_cast<size_t>(info.st_size), MADV_SEQUENTIAL);
+            mapping = view;
+            first = static_cast<const char*>(view);
+            length = static_cast<size_t>(info.st_size);
+            return;
+        }
+    }
+#endif
+    char chunk[INPUT_READ_SIZE];
+    for (;;)
+    {
+        const auto count = read_fd(fd, chunk, INPUT_READ_SIZE);
+        if (count <= 0)
+        {
+            break;
+        }
+        buffer.append(chunk, static_cast<size_t>(count));
+    }
+    first = buffer.data();
+    length = buffer.size();
+}
+
+mapped_input::~mapped_input()
+{
+#ifdef HAVE_MMAP
+    if (mapping)
+    {
+        munmap(mapping, length);
+    }
+#endif
+}
+
+// Single-pass reader over the raw bytes; every value is read exactly once
+class combinations_parser
+{
+public:
+    combinations_parser(const char *begin, const char *end) : cursor(begin), last(end) {}
+
+    possible_combinations parse()
+    {
+        possible_combinations pc;
+        // A leading byte order mark is skipped, as nlohmann::json does
+        if (last - cursor >= 3 && memcmp(cursor, "\xEF\xBB\xBF", 3) == 0)
+        {
+            cursor += 3;
+        }
+        skip_whitespace();
+        if (at('['))
+        {
+            ++cursor;
+            if (!close(']'))
+            {
+                do
+                {
+                    value_column values;
+                    parse_values(pc.combinations, values);
+                    pc.combinations.append_column(std::move(values));
+                }
+                while (next_element(']'));
+            }
+        }
+        else if (at('{'))
+        {
+            // Sorted, last duplicate wins: the same order nlohmann::json gave
+            std::map<string, value_column> columns;
+            ++cursor;
+            if (!close('}'))
+            {
+                do
+                {
+                    skip_whitespace();
+                    string key = parse_string();
+                    skip_whitespace();
+                    expect(':');
+                    value_column values;
+                    parse_values(pc.combinations, values);
+                    columns[std::move(key)] = std::move(values);
+                }
+                while (next_element('}'));
+            }
+            for (auto &column: columns)
+            {
+                pc.keys.push_back(column.first);
+                pc.combinations.append_column(std::move(column.second));
+            }
+        }
+        else
+        {
+            reject_value();
+        }
+        skip_whitespace();
+        if (cursor != last)
+        {
+            throw input_parse_error("unexpected trailing characters");
+        }
+        return pc;
+    }
+
+private:
+    void parse_values(value_table &table, value_column &values)
+    {
+        skip_whitespace();
+        if (!at('['))
+        {
+            reject_value();
+        }
+        ++cursor;
+        if (close(']'))
+        {
+            return;
+        }
+        do
+        {
+            skip_whitespace();
+            if (!at('"'))
+            {
+                reject_value();
+            }
+            values.push_back(parse_value(table));
+        }
+        while (next_element(']'));
+    }
+
+    // A string without escapes is referenced in place; only escaped strings
+    // are decoded and copied into the table's arena
+    value_view parse_value(value_table &table)
+    {
+        const char *start = cursor + 1;
+        if (!scan_run(start))
+        {
+            cursor = start - 1;
+            const string value = parse_string();
+            return table.store(value.data(), value.size());
+        }
+        return value_view(start, cursor++ - start);
+    }
+
+    // Moves the cursor from run to the next quote or escape. Returns true if it
+    // stopped at the closing quote.
+    bool scan_run(const char *run)
+    {
+        cursor = run;
+        while (cursor != last && *cursor != '"' && *cursor != '\\')
+        {
+            const unsigned char byte = static_cast<unsigned char>(*cursor);
+            if (byte < 0x20)
+            {
+                throw input_parse_error("control character in string");
+            }
+            if (byte < 0x80)
+            {
+                ++cursor;
+                continue;
+            }
+            const size_t length = utf8_sequence_length(reinterpret_cast<const unsigned char*>(cursor), reinterpret_cast<const unsigned char*>(last));
+            if (length == 0)
+            {
+                throw input_parse_error("invalid UTF-8 in string");
+            }
+            cursor += length;
+        }
+        if (cursor == last)
+        {
+            throw input_parse_error("unterminated string");
+        }
+        return *cursor == '"';
+    }
+
+    string parse_string()
+    {
+        expect('"');
+        string value;
+        for (;;)
+        {
+            // Copy plain runs in one go, stopping only at quotes and escapes
+            const char *run = cursor;
+            const bool closed = scan_run(run);
+            value.append(run, cursor);
+            ++cursor;
+            if (closed)
+            {
+                return value;
+            }
+            append_escape(value);
+        }
+    }
+
+    void append_escape(string &value)
+    {
+        if (cursor == last)
+        {
+            throw input_parse_error("unterminated escape");
+        }
+        switch (*cursor++)
+        {
+            case '"':  value += '"';  return;
+            case '\\': value += '\\'; return;
+            case '/':  value += '/';  return;
+            case 'b':  value += '\b'; return;
+            case 'f':  value += '\f'; return;
+            case 'n':  value += '\n'; return;
+            case 'r':  value += '\r'; return;
+            case 't':  value += '\t'; return;
+            case 'u':  break;
+            default:   throw input_parse_error("invalid escape");
+        }
+        unsigned long code = parse_hex4();
+        if (code >= 0xD800 && code <= 0xDBFF)
+        {
+            if (last - cursor < 2 || cursor[0] != '\\' || cursor[1] != 'u')
+            {
+                throw input_parse_error("unpaired surrogate");
+            }
+            cursor += 2;
+            const unsigned long low = parse_hex4();
+            if (low < 0xDC00 || low > 0xDFFF)
+            {
+                throw input_parse_error("unpaired surrogate");
+            }
+            code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+        }
+        else if (code >= 0xDC00 && code <= 0xDFFF)
+        {
+            throw input_parse_error("unpaired surrogate");
+        }
+        append_utf8(value, code);
+    }
+
+    unsigned long parse_hex4()
+    {
+        if (last - cursor < 4)
+        {
+            throw input_parse_error("truncated \\u escape");
+        }
+        unsigned long code = 0;
+        for (int i = 0; i < 4; ++i)
+        {
+            const char c = *cursor++;
+            code <<= 4;
+            if (c >= '0' && c <= '9')
+            {
+                code |= c - '0';
+            }
+            else if (c >= 'a' && c <= 'f')
+            {
+                code |= c - 'a' + 10;
+            }
+            else if (c >= 'A' && c <= 'F')
+            {
+                code |= c - 'A' + 10;
+            }
+            else
+            {
+                throw input_parse_error("invalid \\u escape");
+            }
+        }
+        return code;
+    }
+
+    static void append_utf8(string &value, const unsigned long &code)
+    {
+        if (code < 0x80)
+        {
+            value += static_cast<char>(code);
+        }
+        else if (code < 0x800)
+        {
+            value += static_cast<char>(0xC0 | (code >> 6));
+            value += static_cast<char>(0x80 | (code & 0x3F));
+        }
+        else if (code < 0x10000)
+        {
+            value += static_cast<char>(0xE0 | (code >> 12));
+            value += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+            value += static_cast<char>(0x80 | (code & 0x3F));
+        }
+        else
+        {
+            value += static_cast<char>(0xF0 | (code >> 18));
+            value += static_cast<char>(0x80 | ((code >> 12) & 0x3F));
+            value += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+            value += static_cast<char>(0x80 | (code & 0x3F));
+        }
+    }
+
+    // Anything that could start another JSON value is well-formed input of the
+    // wrong shape; everything else is not JSON at all
+    [[noreturn]] void reject_value() const
+    {
+        if (cursor != last && strchr("\"-0123456789tfn[{", *cursor) && *cursor != '\0')
+        {
+            throw input_type_error("expected an array of strings");
+        }
+        throw input_parse_error("expected a value");
+    }
+
+    // After an element: true on ',', false on the closing bracket
+    bool next_element(const char &closing)
+    {
+        skip_whitespace();
+        if (at(','))
+        {
+            ++cursor;
+            return true;
+        }
+        expect(closing);
+        return false;
+    }
+
+    // Right after an opening bracket: consumes the closing one if the container is empty
+    bool close(const char &closing)
+    {
+        skip_whitespace();
+        if (at(closing))
+        {
+            ++cursor;
+            return true;
+        }
+        return false;
+    }
+
+    void expect(const char &c)
+    {
+        if (!at(c))
+        {
+            throw input_parse_error(string("expected '") + c + "'");
+        }
+        ++cursor;
+    }
+
+    bool at(const char &c) const
+    {
+        return cursor != last && *cursor == c;
+    }
+
+    void skip_whitespace()
+    {
+        while (cursor != last && (*cursor == ' ' || *cursor == '\n' || *cursor == '\r' || *cursor == '\t'))
+        {
+            ++cursor;
+        }
+    }
+
+    const char                      *cursor;
+    const char                      *last;
+};
+
+possible_combinations parse_combinations(const std::shared_ptr<const mapped_input> &input)
+{
+    possible_combinations pc = combinations_parser(input->begin(), input->end()).parse();
+    pc.combinations.keep(input);
+    return pc;
+}
+
+const void append_lines(const mapped_input &input, value_column &values)
+{
+    const char *line = input.begin();
+    while (line != input.end())
+    {
+        const char *found = static_cast<const char*>(memchr(line, '\n', input.end() - line));
+        const char *line_end = found ? found : input.end();
+        const char *value_end = line_end != line && line_end[-1] == '\r' ? line_end - 1 : line_end;
+        values.push_back(value_view(line, value_end - line));
+        line = found ? found + 1 : input.end();
+    }
+}
+
+#endif
@@ -0,0 +1,93 @@
+/* input_reader.h
+ *
+ * Copyright (C) 2018 Tyler Burdsall
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef INPUT_READER_H
+#define INPUT_READER_H
+
+#include <memory>
+#include "combigen.h"
+
+const int                    STANDARD_INPUT_FD = 0;
+
+// The input is not valid JSON
+struct input_parse_error : runtime_error
+{
+    explicit input_parse_error(const string &what) : runtime_error(what) {}
+};
+
+// The input is valid JSON but not an object or array of string arrays
+struct input_type_error : runtime_error
+{
+    explicit input_type_error(const string &what) : runtime_error(what) {}
+};
+
+/*
+ * Read-only view of everything readable from a file descriptor. Regular files,
+ * including one redirected to stdin, are memory-mapped so the input is never
+ * copied; pipes and platforms without mmap are read into a buffer instead.
+ */
+class mapped_input
+{
+public:
+    explicit mapped_input(const int &fd);
+    ~mapped_input();
+
+    mapped_input(const mapped_input &) = delete;
+    mapped_input &operator=(const mapped_input &) = delete;
+
+    const char *begin() const
+    {
+        return first;
+    }
+
+    const char *end() const
+    {
+        return first + length;
+    }
+
+private:
+    const char                      *first;
+    size_t                          length;
+    void                            *mapping;
+    string                          buffer;
+};
+
+/*
+ * Parses { "key": [ "value", ... ], ... } or [ [ "value", ... ], ... ] in a
+ * single pass without building a JSON document first. Values without escapes
+ * are views straight into the input, which the result keeps alive; the rest
+ * are decoded into its arena. Keys come out sorted and a repeated key keeps
+ * its last array, exactly like the nlohmann::json objects this replaces.
+ */
+possible_combinations        parse_combinations(const std::shared_ptr<const mapped_input> &input);
+
+/*
+ * Returns the first byte in [begin, end) that does not start a well-formed
+ * UTF-8 sequence, or end if there is none. Overlong forms, surrogates and
+ * code points past U+10FFFF are rejected, as nlohmann::json does.
+ */
+const char                   *find_invalid_utf8(const char *begin, const char *end);
+
+/*
+ * Appends every line of the input to values as a view into it, without the
+ * line break or a trailing '\r'. A final line break does not start another
+ * value, but any other empty line is an empty value.
+ */
+const void                   append_lines(const mapped_input &input, value_column &values);
+
+#endif
@@ -25,19 +25,93 @@
 
 #if defined(WIN32) || defined(_WIN32) || defined(__WIN32) && !defined(__CYGWIN__)
 #include "lib/win-getopt/getopt.h"
+#include <fcntl.h>
+#include <io.h>
 #else
-#include <unistd.h>
+#include <getopt.h>
 #endif
 
+#include <algorithm>
+#include <cerrno>
+#include <limits>
 #include "combigen.h"
 #include "cli_functions.h"
+#include "row_serializer.h"
+#include "index_permutation.h"
+#include "partition_writer.h"
+#include "file_io.h"
+
+// Options that only have a long form
+enum long_options
+{
+    OPT_THREADS = 256,
+    OPT_SHARD,
+    OPT_FROM,
+    OPT_TO,
+    OPT_BUFFER_SIZE,
+    OPT_BATCH_SIZE,
+    OPT_SEED,
+    OPT_UNORDERED,
+    OPT_REPLACE,
+    OPT_STREAM,
+    OPT_MANIFEST,
+    OPT_MAX_MEMORY,
+    OPT_PART_ROWS,
+    OPT_PART_BYTES,
+    OPT_PARTITION_BY,
+    OPT_COMPRESS
+};
+
+static const struct option long_opts[] =
+{
+    { "threads", required_argument, 0, OPT_THREADS },
+    { "shard",   required_argument, 0, OPT_SHARD },
+    { "from",    required_argument, 0, OPT_FROM },
+    { "to",      required_argument, 0, OPT_TO },
+    { "buffer-size", required_argument, 0, OPT_BUFFER_SIZE },
+    { "batch-size",  required_argument, 0, OPT_BATCH_SIZE },
+    { "seed",    required_argument, 0, OPT_SEED },
+    { "unordered", no_argument,     0, OPT_UNORDERED },
+    { "replace", no_argument,       0, OPT_REPLACE },
+    { "stream",  no_argument,       0, OPT_STREAM },
+    { "manifest", required_argument, 0, OPT_MANIFEST },
+    { "max-memory", required_argument, 0, OPT_MAX_MEMORY },
+    { "part-rows", required_argument, 0, OPT_PART_ROWS },
+    { "part-bytes", required_argument, 0, OPT_PART_BYTES },
+    { "partition-by", required_argument, 0, OPT_PARTITION_BY },
+    { "compress", required_argument, 0, OPT_COMPRESS },
+    { 0,         0,                 0, 0 }
+};
+
+// Plain byte count with an optional K, M or G suffix. Returns false for zero
+// and for counts that overflow size_t, which is only 32 bits on some platforms
+static bool parse_byte_size(string s, size_t &bytes)
+{
+    unsigned long long multiplier = 1;
+    if (!s.empty() && string("KMG").find(s.back()) != string::npos)
+    {
+        multiplier = s.back() == 'K' ? 1ULL << 10 : s.back() == 'M' ? 1ULL << 20 : 1ULL << 30;
+        s.pop_back();
+    }
+    if (s.empty() || s.size() > 19 || s.find_first_not_of("0123456789") != string::npos)
+    {
+        return false;
+    }
+    const unsigned long long value = std::stoull(s, 0, 10);
+    if (value == 0 || value > std::numeric_limits<size_t>::max() / multiplier)
+    {
+        return false;
+    }
+    bytes = static_cast<size_t>(value * multiplier);
+    return true;
+}
 
 int main(int argc, char* argv[])
 {
     int             c;
     bool            args_provided = false;
     generation_args args;
-    while ( (c = getopt(argc, argv, "han:i:t:r:d:kvp")) != -1)
+    while ( (c = getopt_long(argc, argv, "han:i:o:t:r:d:kvp", long_opts, 0)) != -1)
     {
         switch (c)
         {
@@ -70,13 +144,31 @@ int main(int argc, char* argv[])
                     args_provided = true;
                 }
                 break;
+            case 'o':
+                if (optarg)
+                {
+                    args.output = optarg;
+                }
+                break;
             case 't':
                 if (optarg)
                 {
                     string s = optarg;
                     if (s == "json")
                     {
-                        args.display_json = true;
+                        args.type = output_type::json;
+                    }
+                    else if (s == "jsonl")
+                    {
+                        args.type = output_type::jsonl;
+                    }
+                    else if (s == "dict")
+                    {
+                        args.type = output_type::dict;
+                    }
+                    else if (s == "arrow")
+                    {
+                        args.type = output_type::arrow;
                     }
                     else if (s != "csv")
                     {
@@ -110,6 +202,165 @@ int main(int argc, char* argv[])
                 args.perf_mode = true;
                 args_provided = true;
                 break;
+            case OPT_THREADS:
+                if (optarg)
+                {
+                    string s = optarg;
+                    if (s.empty() || s.size() > 4 || s.find_first_not_of("0123456789") != string::npos || stoul(s, 0, 10) == 0)
+                    {
+                        display_help();
+                        exit(-1);
+                    }
+                    args.threads = stoul(s, 0, 10);
+                }
+                break;
+            case OPT_SHARD:
+                if (optarg)
+                {
+                    string s = optarg;
+                    const size_t slash = s.find('/');
+                    const string k = s.substr(0, slash);
+                    const string n = slash == string::npos ? "" : s.substr(slash + 1);
+                    if (k.empty() || n.empty() || k.size() > 18 || n.size() > 18
+                        || k.find_first_not_of("0123456789") != string::npos
+                        || n.find_first_not_of("0123456789") != string::npos)
+                    {
+                        display_help();
+                        exit(-1);
+                    }
+                    args.shard_index = std::stoull(k, 0, 10);
+                    args.shard_count = std::stoull(n, 0, 10);
+                    if (args.shard_count == 0 || args.shard_index >= args.shard_count)
+                    {
+                        display_help();
+                        exit(-1);
+                    }
+                }
+                break;
+            case OPT_FROM:
+            case OPT_TO:
+                if (optarg)
+                {
+                    string s = optarg;
+                    if (s.empty() || s.find_first_not_of("0123456789") != string::npos)
+                    {
+                        display_help();
+                        exit(-1);
+                    }
+                    if (c == OPT_FROM)
+                    {
+                        args.range_from = s;
+                    }
+                    else
+                    {
+                        args.range_to = s;
+                    }
+                    args.range_provided = true;
+                    args_provided = true;
+                }
+                break;
+            case OPT_BUFFER_SIZE:
+            case OPT_MAX_MEMORY:
+            case OPT_PART_BYTES:
+                if (optarg && !parse_byte_size(optarg, c == OPT_BUFFER_SIZE ? args.buffer_size : c == OPT_MAX_MEMORY ? args.max_memory : args.part_bytes))
+                {
+                    display_help();
+                    exit(-1);
+                }
+                break;
+            case OPT_BATCH_SIZE:
+                if (optarg)
+                {
+                    string s = optarg;
+                    if (s.empty() || s.size() > 9 || s.find_first_not_of("0123456789") != string::npos || stoul(s, 0, 10) == 0)
+                    {
+                        display_help();
+                        exit(-1);
+                    }
+                    args.batch_size = stoul(s, 0, 10);
+                }
+                break;
+            case OPT_PART_ROWS:
+                if (optarg)
+                {
+                    string s = optarg;
+                    if (s.empty() || s.size() > 18 || s.find_first_not_of("0123456789") != string::npos || std::stoull(s, 0, 10) == 0)
+                    {
+                        display_help();
+                        exit(-1);
+                    }
+                    args.part_rows = std::stoull(s, 0, 10);
+                }
+                break;
+            case OPT_SEED:
+                if (optarg)
+                {
+                    string s = optarg;
+                    if (s.empty() || s.size() > 19 || s.find_first_not_of("0123456789") != string::npos)
+                    {
+                        display_help();
+                        exit(-1);
+                    }
+                    args.seed = std::stoull(s, 0, 10);
+                    args.seed_provided = true;
+                }
+                break;
+            case OPT_UNORDERED:
+                args.unordered = true;
+                break;
+            case OPT_REPLACE:
+                args.with_replacement = true;
+                break;
+            case OPT_STREAM:
+                args.stream = true;
+                args_provided = true;
+                break;
+            case OPT_PARTITION_BY:
+                if (optarg)
+                {
+                    args.partition_by = optarg;
+                }
+                break;
+            case OPT_COMPRESS:
+                if (optarg)
+                {
+                    string s = optarg;
+                    if (s == "gzip")
+                    {
+                        args.compression = output_compression::gzip;
+                    }
+                    else if (s == "zstd")
+                    {
+                        args.compression = output_compression::zstd;
+                    }
+                    else
+                    {
+                        display_help();
+                        exit(-1);
+                    }
+#ifndef USE_ZLIB
+                    if (args.compression == output_compression::gzip)
+                    {
+                        cerr << "ERROR: this build of combigen was compiled without gzip support\n";
+                        exit(-1);
+                    }
+#endif
+#ifndef USE_ZSTD
+                    if (args.compression == output_compression::zstd)
+                    {
+                        cerr << "ERROR: this build of combigen was compiled without zstd support\n";
+                        exit(-1);
+                    }
+#endif
+                }
+                break;
+            case OPT_MANIFEST:
+                if (optarg)
+                {
+                    args.manifest = optarg;
+                    args_provided = true;
+                }
+                break;
             default: 
                 display_help();
                 exit(-1);
@@ -120,21 +371,116 @@ int main(int argc, char* argv[])
         display_help();
         exit(0);
     }
-    if (args.input.empty())
+    // Each of these picks which rows are generated, so at most one may be given
+    if (args.generate_all_combinations + args.entry_at_provided + (args.sample_size != "0") + args.range_provided + args.stream > 1)
+    {
+        cerr << "ERROR: only one of -a, -n, -r, --from/--to and --stream can be given\n";
+        exit(-1);
+    }
+    if (args.with_replacement && args.sample_size == "0" && !args.stream)
     {
-        istreambuf_iterator<char> begin(cin), end;
-        string input_stream(begin, end);
-        args.input = input_stream;
-        args.pc = parse_stdin(args.input);
+        cerr << "ERROR: --replace only applies to -r and --stream\n";
+        exit(-1);
+    }
+    if (!args.seed_provided)
+    {
+        // Shards of one sample must agree on the permutation they slice
+        if (args.shard_count > 1 && (args.sample_size != "0" || args.stream) && !args.generate_all_combinations && !args.range_provided)
+        {
+            cerr << "ERROR: every --shard of a random sample needs the same --seed\n";
+            exit(-1);
+        }
+        args.seed = random_permutation_seed();
+    }
+    if (!args.manifest.empty())
+    {
+        if (!args.input.empty())
+        {
+            cerr << "ERROR: -i and --manifest cannot be used together\n";
+            exit(-1);
+        }
+        args.pc = parse_manifest(args.manifest);
+    }
+    else if (args.input.empty())
+    {
+        args.pc = parse_stdin();
     }
     else
     {
         args.pc = parse_file(args.input);
     }
-    
     try
     {
-        parse_args(args);
+        args.fragments = compile_fragments(args);
+
+        if (!args.partition_by.empty())
+        {
+            const auto key = std::find(args.pc.keys.begin(), args.pc.keys.end(), args.partition_by);
+            if (key == args.pc.keys.end())
+            {
+                cerr << "ERROR: --partition-by " << args.partition_by << " is not a key of the input\n";
+                exit(-1);
+            }
+            if (args.output.empty())
+            {
+                cerr << "ERROR: --partition-by needs -o <directory>\n";
+                exit(-1);
+            }
+            if (args.part_rows > 0 || args.part_bytes > 0)
+            {
+                cerr << "ERROR: --partition-by cannot be combined with --part-rows or --part-bytes\n";
+                exit(-1);
+            }
+            if (!args.generate_all_combinations && !args.range_provided && args.sample_size == "0" && !args.stream)
+            {
+                cerr << "ERROR: --partition-by only applies to -a, --from/--to, -r and --stream\n";
+                exit(-1);
+            }
+            args.partition_column = key - args.pc.keys.begin();
+            args.partition_ids = compile_partition_ids(args);
+            if (make_directory(args.output.c_str()) != 0 && errno != EEXIST)
+            {
+                cerr << "ERROR: Unable to create the output directory " << args.output << '\n';
+                exit(-1);
+            }
+        }
+        else if (args.part_rows > 0 || args.part_bytes > 0)
+        {
+            if (args.output.empty())
+            {
+                cerr << "ERROR: --part-rows and --part-bytes need -o <directory>\n";
+                exit(-1);
+            }
+            if (!args.generate_all_combinations && !args.range_provided && args.sample_size == "0" && !args.stream)
+            {
+                cerr << "ERROR: --part-rows and --part-bytes only apply to -a, --from/--to, -r and --stream\n";
+                exit(-1);
+            }
+            if (args.part_bytes > 0)
+            {
+                // Parts are cut at row counts, sized from the mean row so they come out close to part_bytes
+                const unsigned long long rows = static_cast<unsigned long long>(std::max(1.0, args.part_bytes / std::max(1.0, args.fragments.mean_row_size)));
+                args.part_rows = args.part_rows > 0 ? std::min(args.part_rows, rows) : rows;
+            }
+            if (make_directory(args.output.c_str()) != 0 && errno != EEXIST)
+            {
+                cerr << "ERROR: Unable to create the output directory " << args.output << '\n';
+                exit(-1);
+            }
+        }
+
+#if defined(WIN32) || defined(_WIN32) || defined(__WIN32) && !defined(__CYGWIN__)
+        if (args.type == output_type::dict || args.type == output_type::arrow || args.compression != output_compression::none)
+        {
+            _setmode(STANDARD_OUTPUT_FD, _O_BINARY);
+        }
+#endif
+        output_writer out(STANDARD_OUTPUT_FD, args.buffer_size, args.compression);
+        if (!args.output.empty() && args.part_rows == 0 && args.partition_by.empty())
+        {
+            out.open_file(args.output);
+        }
+        parse_args(args, out);
     }
     catch (const lazycp::errors::index_error&)
     {
@@ -0,0 +1,199 @@
+/* output_writer.cpp
+ *
+ * Copyright (C) 2018 Tyler Burdsall
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef OUTPUT_WRITER_CPP
+#define OUTPUT_WRITER_CPP
+
+#include <cerrno>
+#include <cstdlib>
+#include <iostream>
+#include "output_writer.h"
+#include "file_io.h"
+
+output_writer::output_writer(const int &fd, const size_t &capacity, const output_compression &compression)
+    : fd(fd), owns_fd(false), capacity(capacity > 0 ? capacity : DEFAULT_OUTPUT_BUFFER_SIZE), alignment(1), handed_off(0),
+      preallocated(false), has_pending(false), closing(false)
+{
+    data.reserve(this->capacity);
+    pending.reserve(this->capacity);
+    if (compression != output_compression::none)
+    {
+        const unsigned int cores = std::thread::hardware_concurrency();
+        compressor.reset(new block_compressor(compression, cores > 0 ? cores : 1));
+    }
+    writer = std::thread(&output_writer::drain, this);
+}
+
+output_writer::~output_writer()
+{
+    flush();
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        closing = true;
+    }
+    ready.notify_all();
+    writer.join();
+    finish_blocks();
+    if (owns_fd)
+    {
+        close_file();
+    }
+}
+
+void output_writer::write(const char *bytes, const size_t &size)
+{
+    // Anything that doesn't fit is still copied in once, so it drains in the background too
+    data.append(bytes, size);
+    commit();
+}
+
+void output_writer::write(const std::string &bytes)
+{
+    write(bytes.data(), bytes.size());
+}
+
+void output_writer::flush()
+{
+    hand_off(data.size());
+}
+
+// Everything written so far goes to the previous output; the new file starts empty
+void output_writer::open_file(const std::string &path)
+{
+    flush();
+    wait_idle();
+    finish_blocks();
+    if (owns_fd)
+    {
+        close_file();
+    }
+    fd = open_output(path);
+    if (fd < 0)
+    {
+        std::cerr << "ERROR: Unable to open " << path << " for writing\n";
+        exit(-1);
+    }
+    owns_fd = true;
+    // Compressed blocks come out at whatever size they compress to
+    alignment = capacity >= OUTPUT_FILE_ALIGNMENT && !compressor ? OUTPUT_FILE_ALIGNMENT : 1;
+    handed_off = 0;
+    preallocated = false;
+}
+
+// Reserves bytes past what has been written so far; a hint that is ignored where
+// unsupported, and when compressing, where the final size is not known. A disk
+// without room for them fails the run here rather than partway through.
+void output_writer::preallocate(const unsigned long long &bytes)
+{
+#if defined(__linux__) && defined(FALLOC_FL_KEEP_SIZE)
+    if (owns_fd && bytes > 0 && !compressor)
+    {
+        // KEEP_SIZE leaves the file length alone; close_file gives back what goes unused
+        if (fallocate(fd, FALLOC_FL_KEEP_SIZE, static_cast<off_t>(handed_off + data.size()), static_cast<off_t>(bytes)) == 0)
+        {
+            preallocated = true;
+        }
+        else if (errno == ENOSPC)
+        {
+            std::cerr << "ERROR: Not enough disk space to write output\n";
+            exit(-1);
+        }
+    }
+#else
+    (void)bytes;
+#endif
+}
+
+// Closes the file open_file opened; everything handed off must have been written
+void output_writer::close_file()
+{
+#if defined(__linux__) && defined(FALLOC_FL_KEEP_SIZE)
+    // Truncating to the length written frees the blocks reserved past it, e.g.
+    // when the mean row size overestimated the rows actually written
+    if (preallocated && ftruncate(fd, static_cast<off_t>(handed_off)) != 0)
+    {
+        std::cerr << "ERROR: Unable to write output\n";
+        exit(-1);
+    }
+#endif
+    close_fd(fd);
+}
+
+// Waits for the writer to finish the previous buffer, then hands it the first
+// size bytes of this one; the rest stays behind for the next hand-off
+void output_writer::hand_off(const size_t &size)
+{
+    if (size == 0)
+    {
+        return;
+    }
+    {
+        std::unique_lock<std::mutex> guard(lock);
+        ready.wait(guard, [&]() { return !has_pending; });
+        data.swap(pending);
+        data.assign(pending, size, std::string::npos);
+        pending.resize(size);
+        has_pending = true;
+    }
+    handed_off += size;
+    ready.notify_all();
+}
+
+void output_writer::wait_idle()
+{
+    std::unique_lock<std::mutex> guard(lock);
+    ready.wait(guard, [&]() { return !has_pending; });
+}
+
+// Writes out the blocks still being compressed; the writer thread must be idle
+void output_writer::finish_blocks()
+{
+    if (compressor)
+    {
+        compressor->finish([this](const char *bytes, size_t size) { write_fully(fd, bytes, size); });
+    }
+}
+
+// Writer thread: writes whatever flush() hands over until the writer is destroyed
+void output_writer::drain()
+{
+    std::unique_lock<std::mutex> guard(lock);
+    for (;;)
+    {
+        ready.wait(guard, [&]() { return has_pending || closing; });
+        if (!has_pending)
+        {
+            return;
+        }
+        guard.unlock();
+        if (compressor)
+        {
+            compressor->submit(pending, [this](const char *bytes, size_t size) { write_fully(fd, bytes, size); });
+        }
+        else
+        {
+            write_fully(fd, pending.data(), pending.size());
+        }
+        pending.clear();
+        guard.lock();
+        has_pending = false;
+        ready.notify_all();
+    }
+}
+
+#endif
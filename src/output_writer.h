@@ -0,0 +1,107 @@
+/* output_writer.h
+ *
+ * Copyright (C) 2018 Tyler Burdsall
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef OUTPUT_WRITER_H
+#define OUTPUT_WRITER_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include "block_compressor.h"
+
+const int                    STANDARD_OUTPUT_FD = 1;
+const size_t                 DEFAULT_OUTPUT_BUFFER_SIZE = 1 << 20;
+// Files opened with open_file are written in whole multiples of this many bytes
+const size_t                 OUTPUT_FILE_ALIGNMENT = 1 << 16;
+
+/*
+ * Collects output in one large byte buffer and hands it to the OS with a single
+ * write(2) whenever the buffer fills up, bypassing iostreams entirely. Rows are
+ * appended straight into buffer() and followed by a call to commit().
+ *
+ * The write(2) calls happen on a writer thread: a full buffer is swapped with
+ * the one the writer finished last, so generation carries on into an empty
+ * buffer while the other drains. Only when the writer is still busy with the
+ * previous buffer does a flush wait, which holds generation back to the speed
+ * of a slow consumer without using more than two buffers.
+ *
+ * open_file switches the output to a file the writer owns. File writes are
+ * kept to whole multiples of OUTPUT_FILE_ALIGNMENT, so every write(2) starts
+ * and ends on a block boundary, and preallocate reserves the space the rest
+ * of the file is expected to take up front. Whatever is left unused is given
+ * back when the file is closed.
+ *
+ * With compression, each handed-off buffer is a block for a block_compressor
+ * instead, which compresses blocks on every core and writes them in order.
+ */
+class output_writer
+{
+public:
+    output_writer(const int &fd, const size_t &capacity, const output_compression &compression = output_compression::none);
+    ~output_writer();
+
+    std::string &buffer()
+    {
+        return data;
+    }
+
+    // Flushes once the buffer has grown to its capacity
+    void commit()
+    {
+        if (data.size() >= capacity)
+        {
+            hand_off(data.size() - data.size() % alignment);
+        }
+    }
+
+    void write(const char *bytes, const size_t &size);
+    void write(const std::string &bytes);
+    void flush();
+    void open_file(const std::string &path);
+    void preallocate(const unsigned long long &bytes);
+
+private:
+    void hand_off(const size_t &size);
+    void wait_idle();
+    void finish_blocks();
+    void drain();
+    void close_file();
+
+    int                             fd;
+    bool                            owns_fd;
+    size_t                          capacity;
+    size_t                          alignment;
+    // Bytes handed to the writer since the current file was opened
+    unsigned long long              handed_off;
+    // Whether preallocate reserved space in the current file
+    bool                            preallocated;
+    std::string                     data;
+    // Handed to the writer thread by flush(), guarded by lock
+    std::string                     pending;
+    bool                            has_pending;
+    bool                            closing;
+    std::mutex                      lock;
+    std::condition_variable         ready;
+    std::unique_ptr<block_compressor> compressor;
+    std::thread                     writer;
+};
+
+#endif
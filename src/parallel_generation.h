@@ -0,0 +1,536 @@
+/* parallel_generation.h
+ *
+ * Copyright (C) 2018 Tyler Burdsall
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PARALLEL_GENERATION_H
+#define PARALLEL_GENERATION_H
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include "combigen.h"
+#include "cli_functions.h"
+#include "row_serializer.h"
+#include "index_permutation.h"
+#include "partition_writer.h"
+
+// Rows serialized per chunk, and how many finished chunks a worker may hold
+// before it has to wait for the writer to catch up
+const unsigned long long     PARALLEL_CHUNK_ROWS = 16384;
+const size_t                 PARALLEL_CHUNK_DEPTH = 2;
+
+template <typename Chunk>
+struct parallel_worker_queue
+{
+    std::mutex                      lock;
+    std::condition_variable         ready;
+    std::deque<Chunk>               chunks;
+};
+
+/*
+ * Splits total items into args.shard_count near-equal contiguous slices and
+ * returns the offset and size of slice args.shard_index. Only division and
+ * remainder are used, so this cannot overflow for any index type.
+ */
+template <typename Index>
+void shard_bounds(const Index &total, const generation_args &args, Index &first, Index &count)
+{
+    const Index shards = args.shard_count;
+    const Index k = args.shard_index;
+    const Index base = total / shards;
+    const Index extra = total % shards;
+    first = k * base + (k < extra ? k : extra);
+    count = base + (k < extra ? 1 : 0);
+}
+
+// Lets serialize_range fill either a worker's private buffer or the output writer
+inline string &row_buffer(string &out)
+{
+    return out;
+}
+
+inline string &row_buffer(output_writer &out)
+{
+    return out.buffer();
+}
+
+inline void commit_rows(string &)
+{
+}
+
+inline void commit_rows(output_writer &out)
+{
+    out.commit();
+}
+
+/*
+ * Appends one row to out, followed by the JSON separator when separated is
+ * set. Partitioned sinks route the row by its partition and place separators
+ * between the rows of each partition themselves.
+ */
+template <typename Row, typename Sink>
+inline void append_row(row_serializer &serializer, const Row &row, const bool &separated, const generation_args &args, Sink &out)
+{
+    string &buffer = row_buffer(out);
+    serializer.append(row, buffer);
+    if (args.type == output_type::json && separated)
+    {
+        buffer += ',';
+    }
+    commit_rows(out);
+}
+
+template <typename Row>
+inline void append_row(row_serializer &serializer, const Row &row, const bool &, const generation_args &, partitioned_rows &out)
+{
+    out.append(serializer, row);
+}
+
+template <typename Row>
+inline void append_row(row_serializer &serializer, const Row &row, const bool &, const generation_args &, partition_writer &out)
+{
+    out.append(serializer, row);
+}
+
+template <typename Sink>
+inline void finish_rows(row_serializer &serializer, Sink &out)
+{
+    serializer.finish(row_buffer(out));
+    commit_rows(out);
+}
+
+inline void finish_rows(row_serializer &, partitioned_rows &out)
+{
+    out.finish();
+}
+
+inline void finish_rows(row_serializer &, partition_writer &out)
+{
+    out.finish_batches();
+}
+
+// The private buffer a worker of generate_range_parallel fills for out
+inline string new_chunk(const generation_args &, output_writer &)
+{
+    return string();
+}
+
+inline partitioned_rows new_chunk(const generation_args &args, partition_writer &)
+{
+    return partitioned_rows(args);
+}
+
+// Only a single JSON array needs separators between unordered chunks
+inline void write_chunk_separator(output_writer &out)
+{
+    out.write(",", 1);
+}
+
+inline void write_chunk_separator(partition_writer &)
+{
+}
+
+/*
+ * Serializes the rows in [first, end) into out. The JSON separator is written
+ * after every row except the one at index last, so the concatenated output of
+ * chunks, threads and shards matches a single run byte for byte.
+ */
+template <typename Index, typename Sink>
+void serialize_range(const Index &first, const Index &end, const Index &last, const generation_args &args, Sink &out)
+{
+    combination_iterator row(args.pc.combinations);
+    row_serializer serializer(args);
+    row.seek(first);
+    for (Index i = first; i != end; ++i)
+    {
+        append_row(serializer, row, i != last, args, out);
+        row.next();
+    }
+    finish_rows(serializer, out);
+}
+
+/*
+ * Serializes the sampled rows at positions [first, end) of the permutation,
+ * writing the JSON separator after every position except last
+ */
+template <typename Index, typename Sink>
+void serialize_samples(const index_permutation<Index> &permutation, const Index &first, const Index &end, const Index &last, const generation_args &args, Sink &out)
+{
+    combination_iterator row(args.pc.combinations);
+    row_serializer serializer(args);
+    for (Index i = first; i != end; ++i)
+    {
+        row.seek(permutation.at(i));
+        append_row(serializer, row, i != last, args, out);
+    }
+    finish_rows(serializer, out);
+}
+
+/*
+ * Serializes rows [first, end) of a sample drawn with replacement. Row p
+ * hashes the seed and p into the starting state of its own splitmix64 stream
+ * and draws each column from it, so any row can be produced on its own.
+ * Draws below a column's threshold are rejected to keep draw % radix unbiased.
+ */
+template <typename Sink>
+void serialize_draws(const unsigned long long &first, const unsigned long long &end, const unsigned long long &last, const generation_args &args, Sink &out)
+{
+    const value_table &combinations = args.pc.combinations;
+    vector<unsigned long long> thresholds;
+    for (const value_column &values: combinations)
+    {
+        const unsigned long long radix = values.size();
+        thresholds.push_back((0ULL - radix) % radix);
+    }
+    vector<size_t> digits(combinations.size());
+    row_serializer serializer(args);
+    for (unsigned long long p = first; p != end; ++p)
+    {
+        // Each draw mixes the state, which then advances by the gamma
+        unsigned long long state = mix_bits(args.seed ^ mix_bits(p));
+        for (size_t j = 0; j < digits.size(); ++j)
+        {
+            unsigned long long draw;
+            do
+            {
+                draw = mix_bits(state);
+                state += SPLITMIX_GAMMA;
+            }
+            while (draw < thresholds[j]);
+            digits[j] = static_cast<size_t>(draw % combinations[j].size());
+        }
+        append_row(serializer, digits.data(), p != last, args, out);
+    }
+    finish_rows(serializer, out);
+}
+
+/*
+ * Splits [first, first + count) into contiguous chunks handed out round-robin
+ * to args.threads workers, which call serialize_chunk(start, end, last,
+ * buffer) into private buffers. The calling thread writes the chunks to out
+ * in index order, or with args.unordered in whatever order they finish; JSON
+ * separators are then written between chunks instead of inside them. With a
+ * partition_writer the chunks are partitioned_rows, merged per partition.
+ */
+template <typename Index, typename ChunkSerializer, typename Sink>
+void generate_range_parallel(const Index &first, const Index &count, const Index &last, const generation_args &args, ChunkSerializer serialize_chunk, Sink &out)
+{
+    const unsigned int threads = args.threads;
+    // Arrow chunks are exactly one record batch
+    const Index chunk_rows = args.type == output_type::arrow ? args.batch_size : PARALLEL_CHUNK_ROWS;
+    const Index chunks = (count + chunk_rows - 1) / chunk_rows;
+    // Unordered workers share the first queue, so its depth scales with them
+    const size_t depth = args.unordered ? PARALLEL_CHUNK_DEPTH * threads : PARALLEL_CHUNK_DEPTH;
+    const bool json_between_chunks = args.unordered && args.type == output_type::json;
+    typedef decltype(new_chunk(args, out)) chunk_type;
+    vector<parallel_worker_queue<chunk_type>> queues(threads);
+    vector<std::thread> workers;
+
+    for (unsigned int w = 0; w < threads; ++w)
+    {
+        workers.emplace_back([&, w]()
+        {
+            parallel_worker_queue<chunk_type> &queue = queues[args.unordered ? 0 : w];
+            chunk_type buffer = new_chunk(args, out);
+            for (Index c = w; c < chunks; c += threads)
+            {
+                const Index offset = c * chunk_rows;
+                const Index remaining = count - offset;
+                const Index start = first + offset;
+                const Index end = start + (remaining < chunk_rows ? remaining : chunk_rows);
+                serialize_chunk(start, end, args.unordered ? Index(end - 1) : last, buffer);
+
+                std::unique_lock<std::mutex> guard(queue.lock);
+                queue.ready.wait(guard, [&]() { return queue.chunks.size() < depth; });
+                queue.chunks.push_back(std::move(buffer));
+                buffer.clear();
+                queue.ready.notify_all();
+            }
+        });
+    }
+
+    for (Index c = 0; c < chunks; ++c)
+    {
+        parallel_worker_queue<chunk_type> &queue = queues[args.unordered ? 0 : static_cast<unsigned int>(c % threads)];
+        std::unique_lock<std::mutex> guard(queue.lock);
+        queue.ready.wait(guard, [&]() { return !queue.chunks.empty(); });
+        chunk_type chunk(std::move(queue.chunks.front()));
+        queue.chunks.pop_front();
+        queue.ready.notify_all();
+        guard.unlock();
+        if (json_between_chunks && c > 0)
+        {
+            write_chunk_separator(out);
+        }
+        out.write(chunk);
+    }
+    if (json_between_chunks && count > 0 && Index(first + count - 1) != last)
+    {
+        write_chunk_separator(out);
+    }
+
+    for (std::thread &worker: workers)
+    {
+        worker.join();
+    }
+}
+
+// Asks the filesystem for the space rows of output are expected to take in a -o file
+template <typename Index>
+void preallocate_rows(const Index &rows, const generation_args &args, output_writer &out)
+{
+    // Past a trillion rows the estimate is no longer worth reserving up front
+    if (args.output.empty() || args.stream || rows > Index(1ULL << 40))
+    {
+        return;
+    }
+    out.preallocate(static_cast<unsigned long long>(static_cast<unsigned long long>(rows) * args.fragments.mean_row_size));
+}
+
+/*
+ * Calls emit(start, end, last, sink) for this shard's rows [first, first +
+ * count). Without parts that is a single call ending at the run's last row.
+ * With --part-rows every part_rows rows are a part of their own: a file with
+ * its own header and footer whose rows end at its own last row, so each part
+ * is complete on its own, e.g. JSON arrays are closed. With --partition-by
+ * all rows go to a partition_writer instead of out.
+ */
+template <typename Index, typename Emit>
+void for_each_part(const Index &first, const Index &count, const Index &last, const generation_args &args, output_writer &out, Emit emit)
+{
+    if (!args.partition_by.empty())
+    {
+        partition_writer partitions(args);
+        emit(first, Index(first + count), last, partitions);
+        partitions.close();
+        return;
+    }
+    if (args.part_rows == 0)
+    {
+        preallocate_rows(count, args, out);
+        emit(first, Index(first + count), last, out);
+        return;
+    }
+    const Index part_rows = Index(args.part_rows);
+    Index offset = 0;
+    for (unsigned long long part = 0; offset != count; ++part)
+    {
+        const Index remaining = count - offset;
+        const Index rows = remaining < part_rows ? remaining : part_rows;
+        const Index start = first + offset;
+        output_part_begin(args, part, out);
+        preallocate_rows(rows, args, out);
+        emit(start, Index(start + rows), Index(start + rows - 1), out);
+        output_part_end(args, out);
+        offset += rows;
+    }
+}
+
+/*
+ * Emits this shard's slice of [begin, end) in order, on args.threads threads
+ */
+template <typename Index>
+void generate_shard(const Index &begin, const Index &end, const generation_args &args, output_writer &out)
+{
+    Index first, count;
+    shard_bounds(Index(end - begin), args, first, count);
+    first += begin;
+    for_each_part(first, count, Index(end - 1), args, out, [&](const Index &part_first, const Index &part_end, const Index &part_last, auto &sink)
+    {
+        if (args.threads > 1)
+        {
+            generate_range_parallel(part_first, Index(part_end - part_first), part_last, args, [&](const Index &start, const Index &stop, const Index &last, auto &buffer)
+            {
+                serialize_range(start, stop, last, args, buffer);
+            }, sink);
+        }
+        else
+        {
+            serialize_range(part_first, part_end, part_last, args, sink);
+        }
+    });
+}
+
+/*
+ * Emits this shard's slice of a sample_size random sample out of max_size
+ * combinations: positions of one permutation keyed by args.seed, so the rows
+ * do not depend on the number of threads or shards
+ */
+template <typename Index>
+void generate_sample_shard(const Index &max_size, const Index &sample_size, const generation_args &args, output_writer &out)
+{
+    Index skip, count;
+    shard_bounds(sample_size, args, skip, count);
+    if (count == 0)
+    {
+        return;
+    }
+    const index_permutation<Index> permutation(max_size, args.seed);
+    for_each_part(skip, count, Index(sample_size - 1), args, out, [&](const Index &part_first, const Index &part_end, const Index &part_last, auto &sink)
+    {
+        if (args.threads > 1)
+        {
+            generate_range_parallel(part_first, Index(part_end - part_first), part_last, args, [&](const Index &start, const Index &stop, const Index &last, auto &buffer)
+            {
+                serialize_samples(permutation, start, stop, last, args, buffer);
+            }, sink);
+        }
+        else
+        {
+            serialize_samples(permutation, part_first, part_end, part_last, args, sink);
+        }
+    });
+}
+
+// One batch of decoded sample rows handed from the decoding thread to the writer
+struct sample_batch
+{
+    // Row r holds its digits at [r * columns, (r + 1) * columns)
+    vector<size_t>                  digits;
+    size_t                          count = 0;
+    bool                            filled = false;
+};
+
+// Rows per -p batch: as many as two batches of digit rows fit in args.max_memory,
+// and at least one however small the limit is
+inline size_t pipeline_batch_rows(const generation_args &args)
+{
+    const size_t row_bytes = std::max<size_t>(args.pc.combinations.size(), 1) * sizeof(size_t);
+    const size_t rows = args.max_memory / (2 * row_bytes);
+    return rows == 0 ? 1 : rows;
+}
+
+/*
+ * -p: the rows of serialize_samples, produced in two overlapping stages. A
+ * second thread walks the permutation and decodes each position into digits,
+ * filling one batch while the calling thread serializes and writes the other,
+ * so the expensive wide-integer decode runs alongside the output instead of
+ * ahead of it. Both batches are allocated once and reused, which keeps memory
+ * at args.max_memory however large the sample is.
+ */
+template <typename Index, typename Sink>
+void serialize_samples_pipelined(const index_permutation<Index> &permutation, const Index &first, const Index &end, const Index &last, const generation_args &args, Sink &out)
+{
+    const size_t columns = args.pc.combinations.size();
+    const Index count = end - first;
+    const Index batch_limit = Index(pipeline_batch_rows(args));
+    const size_t batch_rows = static_cast<size_t>(count < batch_limit ? count : batch_limit);
+    sample_batch batches[2];
+    for (sample_batch &batch: batches)
+    {
+        batch.digits.resize(batch_rows * columns);
+    }
+    std::mutex lock;
+    std::condition_variable ready;
+
+    std::thread decoder([&]()
+    {
+        combination_iterator row(args.pc.combinations);
+        Index position = first;
+        for (size_t b = 0; position != end; ++b)
+        {
+            sample_batch &batch = batches[b % 2];
+            {
+                std::unique_lock<std::mutex> guard(lock);
+                ready.wait(guard, [&]() { return !batch.filled; });
+            }
+            size_t filled = 0;
+            for (; filled < batch_rows && position != end; ++filled, ++position)
+            {
+                row.seek(permutation.at(position));
+                std::copy(row.current_digits().begin(), row.current_digits().end(), batch.digits.begin() + filled * columns);
+            }
+            std::lock_guard<std::mutex> guard(lock);
+            batch.count = filled;
+            batch.filled = true;
+            ready.notify_all();
+        }
+    });
+
+    row_serializer serializer(args);
+    Index position = first;
+    for (size_t b = 0; position != end; ++b)
+    {
+        sample_batch &batch = batches[b % 2];
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            ready.wait(guard, [&]() { return batch.filled; });
+        }
+        for (size_t r = 0; r < batch.count; ++r, ++position)
+        {
+            append_row(serializer, batch.digits.data() + r * columns, position != last, args, out);
+        }
+        std::lock_guard<std::mutex> guard(lock);
+        batch.filled = false;
+        ready.notify_all();
+    }
+    finish_rows(serializer, out);
+    decoder.join();
+}
+
+// -p counterpart of generate_sample_shard
+template <typename Index>
+void generate_sample_pipeline(const Index &max_size, const Index &sample_size, const generation_args &args, output_writer &out)
+{
+    Index skip, count;
+    shard_bounds(sample_size, args, skip, count);
+    if (count == 0)
+    {
+        return;
+    }
+    const index_permutation<Index> permutation(max_size, args.seed);
+    for_each_part(skip, count, Index(sample_size - 1), args, out, [&](const Index &part_first, const Index &part_end, const Index &part_last, auto &sink)
+    {
+        serialize_samples_pipelined(permutation, part_first, part_end, part_last, args, sink);
+    });
+}
+
+/*
+ * Emits this shard's slice of total rows drawn with replacement. Only 64-bit
+ * positions are used, so this never touches the size of the product.
+ */
+inline void generate_draw_shard(const unsigned long long &total, const generation_args &args, output_writer &out)
+{
+    // compute_max_size, which would reject this, is never called for draws
+    for (const value_column &values: args.pc.combinations)
+    {
+        if (values.empty())
+        {
+            throw lazycp::errors::empty_list_error();
+        }
+    }
+    unsigned long long first, count;
+    shard_bounds(total, args, first, count);
+    for_each_part(first, count, total - 1, args, out, [&](const unsigned long long &part_first, const unsigned long long &part_end, const unsigned long long &part_last, auto &sink)
+    {
+        if (args.threads > 1)
+        {
+            generate_range_parallel(part_first, part_end - part_first, part_last, args, [&](const unsigned long long &start, const unsigned long long &stop, const unsigned long long &last, auto &buffer)
+            {
+                serialize_draws(start, stop, last, args, buffer);
+            }, sink);
+        }
+        else
+        {
+            serialize_draws(part_first, part_end, part_last, args, sink);
+        }
+    });
+}
+
+#endif
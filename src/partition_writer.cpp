@@ -0,0 +1,339 @@
+/* partition_writer.cpp
+ *
+ * Copyright (C) 2018 Tyler Burdsall
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PARTITION_WRITER_CPP
+#define PARTITION_WRITER_CPP
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <map>
+#include "partition_writer.h"
+#include "cli_functions.h"
+#include "file_io.h"
+
+// Escapes a key or value for a directory name the way Hive does, so that
+// loaders which read <key>=<value> directories decode it back
+static void append_path_escaped(const value_view &value, string &out)
+{
+    static const string specials = "\"#%'*/:=?\\{}[]^";
+    for (const char &c: value)
+    {
+        const unsigned char byte = static_cast<unsigned char>(c);
+        if (byte < 0x20 || byte == 0x7F || specials.find(c) != string::npos)
+        {
+            char escaped[4];
+            snprintf(escaped, sizeof(escaped), "%%%02X", byte);
+            out += escaped;
+        }
+        else
+        {
+            out += c;
+        }
+    }
+}
+
+string partition_directory(const generation_args &args, const size_t &value)
+{
+    string directory = args.output + "/";
+    append_path_escaped(args.pc.keys[args.partition_column], directory);
+    directory += '=';
+    const value_view &text = args.pc.combinations[args.partition_column][value];
+    if (text.size == 0)
+    {
+        directory += "__HIVE_DEFAULT_PARTITION__";
+    }
+    else
+    {
+        append_path_escaped(text, directory);
+    }
+    return directory;
+}
+
+// Values are compared by directory, so repeated values, and any that escape
+// alike, write to one file instead of truncating each other's
+vector<size_t> compile_partition_ids(const generation_args &args)
+{
+    const size_t values = args.pc.combinations[args.partition_column].size();
+    std::map<string, size_t> first_value;
+    vector<size_t> ids(values);
+    for (size_t v = 0; v < values; ++v)
+    {
+        ids[v] = first_value.emplace(partition_directory(args, v), v).first->second;
+    }
+    return ids;
+}
+
+partitioned_rows::partitioned_rows(const generation_args &args)
+    : args(args)
+{
+    clear();
+}
+
+size_t partitioned_rows::append(row_serializer &serializer, const combination_iterator &row)
+{
+    return append_row(serializer, row, args.partition_ids[row.current_digits()[args.partition_column]]);
+}
+
+size_t partitioned_rows::append(row_serializer &serializer, const size_t *digits)
+{
+    return append_row(serializer, digits, args.partition_ids[digits[args.partition_column]]);
+}
+
+template <typename Row>
+size_t partitioned_rows::append_row(row_serializer &serializer, const Row &row, const size_t &partition)
+{
+    string &buffer = buffers[partition];
+    if (args.type == output_type::json && rows[partition] > 0)
+    {
+        buffer += ',';
+    }
+    // The shared serializer keeps reusing unchanged columns across partitions,
+    // but a record batch may only hold rows of one partition
+    if (args.type == output_type::arrow)
+    {
+        batches[partition].append(row, buffer);
+    }
+    else
+    {
+        serializer.append(row, buffer);
+    }
+    ++rows[partition];
+    return partition;
+}
+
+void partitioned_rows::finish()
+{
+    for (size_t p = 0; p < batches.size(); ++p)
+    {
+        batches[p].finish(buffers[p]);
+    }
+}
+
+void partitioned_rows::clear()
+{
+    const size_t partitions = args.pc.combinations[args.partition_column].size();
+    buffers.assign(partitions, string());
+    rows.assign(partitions, 0);
+    if (args.type == output_type::arrow && batches.empty())
+    {
+        batches.reserve(partitions);
+        for (size_t p = 0; p < partitions; ++p)
+        {
+            batches.emplace_back(args);
+        }
+    }
+}
+
+partition_writer::partition_writer(const generation_args &args)
+    : args(args), rows(args), closed(false), queued_bytes(0), closing(false), clock(0)
+{
+    if (args.compression != output_compression::none)
+    {
+        codec.reset(new block_codec(args.compression));
+    }
+    const size_t partitions = rows.buffers.size();
+    // Only the first value of each partition ever holds rows
+    size_t distinct = 0;
+    for (size_t v = 0; v < partitions; ++v)
+    {
+        distinct += args.partition_ids[v] == v ? 1 : 0;
+    }
+    capacity = std::max(PARTITION_MIN_BUFFER_SIZE, std::min(args.buffer_size, args.max_memory / std::max<size_t>(distinct, 1)));
+    append_output_header(args, header);
+    fds.assign(partitions, -1);
+    created.assign(partitions, false);
+    last_used.assign(partitions, 0);
+    writer = std::thread(&partition_writer::drain, this);
+}
+
+partition_writer::~partition_writer()
+{
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        closing = true;
+    }
+    ready.notify_all();
+    writer.join();
+    for (const size_t &partition: open_files)
+    {
+        close_fd(fds[partition]);
+    }
+}
+
+// Appends a worker's chunk after the rows already written to each partition
+void partition_writer::write(partitioned_rows &chunk)
+{
+    for (size_t p = 0; p < chunk.buffers.size(); ++p)
+    {
+        if (chunk.rows[p] == 0)
+        {
+            continue;
+        }
+        if (args.type == output_type::json && rows.rows[p] > 0)
+        {
+            rows.buffers[p] += ',';
+        }
+        rows.buffers[p] += chunk.buffers[p];
+        rows.rows[p] += chunk.rows[p];
+        commit(p);
+    }
+}
+
+void partition_writer::finish_batches()
+{
+    rows.finish();
+}
+
+// Ends every partition file that was started and waits until all of it is written
+void partition_writer::close()
+{
+    if (closed)
+    {
+        return;
+    }
+    closed = true;
+    rows.finish();
+    for (size_t p = 0; p < rows.buffers.size(); ++p)
+    {
+        if (rows.rows[p] > 0)
+        {
+            append_output_footer(args, rows.buffers[p]);
+            hand_off(p);
+        }
+    }
+    std::unique_lock<std::mutex> guard(lock);
+    ready.wait(guard, [&]() { return queued.empty(); });
+}
+
+void partition_writer::commit(const size_t &partition)
+{
+    if (rows.buffers[partition].size() >= capacity)
+    {
+        hand_off(partition);
+    }
+}
+
+// Queues the partition's buffer for the writer thread, waiting while the
+// buffers already queued hold more than --buffer-size
+void partition_writer::hand_off(const size_t &partition)
+{
+    string &buffer = rows.buffers[partition];
+    if (buffer.empty())
+    {
+        return;
+    }
+    {
+        std::unique_lock<std::mutex> guard(lock);
+        ready.wait(guard, [&]() { return queued_bytes < args.buffer_size; });
+        queued_bytes += buffer.size();
+        queued.emplace_back(partition, std::move(buffer));
+    }
+    buffer.clear();
+    ready.notify_all();
+}
+
+// Writer thread: writes queued buffers to their partition files in order
+void partition_writer::drain()
+{
+    std::unique_lock<std::mutex> guard(lock);
+    for (;;)
+    {
+        ready.wait(guard, [&]() { return !queued.empty() || closing; });
+        if (queued.empty())
+        {
+            return;
+        }
+        const size_t partition = queued.front().first;
+        const string &bytes = queued.front().second;
+        guard.unlock();
+        write_block(open_partition(partition), bytes);
+        guard.lock();
+        queued_bytes -= bytes.size();
+        queued.pop_front();
+        ready.notify_all();
+    }
+}
+
+// Every block is compressed on its own, so the blocks of a file form one stream
+void partition_writer::write_block(const int &fd, const string &bytes)
+{
+    if (!codec)
+    {
+        write_fully(fd, bytes.data(), bytes.size());
+        return;
+    }
+    compressed.clear();
+    codec->compress(bytes.data(), bytes.size(), compressed);
+    write_fully(fd, compressed.data(), compressed.size());
+}
+
+
+// Returns the partition's file, creating it with the header on first use and
+// closing the least recently written file when too many are open
+int partition_writer::open_partition(const size_t &partition)
+{
+    last_used[partition] = ++clock;
+    if (fds[partition] >= 0)
+    {
+        return fds[partition];
+    }
+    if (open_files.size() == PARTITION_OPEN_FILES)
+    {
+        auto oldest = std::min_element(open_files.begin(), open_files.end(), [&](const size_t &a, const size_t &b)
+        {
+            return last_used[a] < last_used[b];
+        });
+        close_fd(fds[*oldest]);
+        fds[*oldest] = -1;
+        *oldest = open_files.back();
+        open_files.pop_back();
+    }
+    const string directory = partition_directory(args, partition);
+    char name[32];
+    if (args.shard_count > 1)
+    {
+        snprintf(name, sizeof(name), "/part-%05llu.", args.shard_index);
+    }
+    else
+    {
+        snprintf(name, sizeof(name), "/part.");
+    }
+    const string path = directory + name + output_extension(args);
+    if (!created[partition] && make_directory(directory.c_str()) != 0 && errno != EEXIST)
+    {
+        std::cerr << "ERROR: Unable to create the output directory " << directory << '\n';
+        exit(-1);
+    }
+    const int fd = created[partition] ? open_append(path) : open_output(path);
+    if (fd < 0)
+    {
+        std::cerr << "ERROR: Unable to open " << path << " for writing\n";
+        exit(-1);
+    }
+    if (!created[partition])
+    {
+        write_block(fd, header);
+        created[partition] = true;
+    }
+    fds[partition] = fd;
+    open_files.push_back(partition);
+    return fd;
+}
+
+#endif
@@ -0,0 +1,129 @@
+/* partition_writer.h
+ *
+ * Copyright (C) 2018 Tyler Burdsall
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PARTITION_WRITER_H
+#define PARTITION_WRITER_H
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include "combigen.h"
+#include "row_serializer.h"
+
+// Partition files kept open at once; the least recently written one is closed first
+const size_t                 PARTITION_OPEN_FILES = 64;
+// Smallest buffer a partition gets, however many partitions share --max-memory
+const size_t                 PARTITION_MIN_BUFFER_SIZE = 4 << 10;
+
+// Directory of the partition that the column's value-th value belongs to
+string                       partition_directory(const generation_args &args, const size_t &value);
+// Maps every value of the --partition-by column to the first value with the same directory
+vector<size_t>               compile_partition_ids(const generation_args &args);
+
+/*
+ * Serialized rows split by the value of the --partition-by column. The
+ * partition of a row is looked up from that column's digit in
+ * args.partition_ids, so rows are routed without looking at the value itself.
+ * Buffers of values that share a partition with an earlier value stay empty. JSON separators go between the rows of a
+ * partition, and Arrow rows are collected into record batches per partition.
+ */
+class partitioned_rows
+{
+public:
+    explicit partitioned_rows(const generation_args &args);
+
+    // Both return the partition the row went to
+    size_t append(row_serializer &serializer, const combination_iterator &row);
+    size_t append(row_serializer &serializer, const size_t *digits);
+    // Closes every partition's open Arrow record batch
+    void finish();
+    void clear();
+
+    // Bytes and number of rows appended to each partition
+    vector<string>                  buffers;
+    vector<unsigned long long>      rows;
+
+private:
+    template <typename Row>
+    size_t append_row(row_serializer &serializer, const Row &row, const size_t &partition);
+
+    const generation_args           &args;
+    vector<row_serializer>          batches;
+};
+
+/*
+ * Writes each partition of the output to <-o>/<key>=<value>/part.<type>, or
+ * part-NNNNN.<type> for shard NNNNN, as a complete file with its own header
+ * and footer. Files are created once their partition has a row, so values
+ * that never occur get no file.
+ *
+ * Every partition has a buffer of its own, sized so all of them together
+ * stay within args.max_memory. A full buffer is handed to a writer thread,
+ * which keeps at most PARTITION_OPEN_FILES files open and reopens a closed
+ * one for appending when its partition gets more rows. With compression,
+ * every buffer the writer thread writes is compressed as a block of its own.
+ */
+class partition_writer
+{
+public:
+    explicit partition_writer(const generation_args &args);
+    ~partition_writer();
+
+    template <typename Row>
+    void append(row_serializer &serializer, const Row &row)
+    {
+        commit(rows.append(serializer, row));
+    }
+
+    void write(partitioned_rows &chunk);
+    void finish_batches();
+    void close();
+
+private:
+    void commit(const size_t &partition);
+    void hand_off(const size_t &partition);
+    void drain();
+    int open_partition(const size_t &partition);
+    void write_block(const int &fd, const string &bytes);
+
+    const generation_args           &args;
+    partitioned_rows                rows;
+    size_t                          capacity;
+    string                          header;
+    bool                            closed;
+    // Buffers handed to the writer thread, guarded by lock
+    std::deque<std::pair<size_t, string>> queued;
+    size_t                          queued_bytes;
+    bool                            closing;
+    std::mutex                      lock;
+    std::condition_variable         ready;
+    // Only touched by the writer thread
+    vector<int>                     fds;
+    vector<bool>                    created;
+    vector<unsigned long long>      last_used;
+    vector<size_t>                  open_files;
+    unsigned long long              clock;
+    std::unique_ptr<block_codec>    codec;
+    string                          compressed;
+    std::thread                     writer;
+};
+
+#endif
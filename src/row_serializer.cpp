@@ -0,0 +1,284 @@
+/* row_serializer.cpp
+ *
+ * Copyright (C) 2018 Tyler Burdsall
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ROW_SERIALIZER_CPP
+#define ROW_SERIALIZER_CPP
+
+#include "row_serializer.h"
+#include "arrow_writer.h"
+
+// Appends value as an RFC 4180 field: it is quoted, with any quotes doubled,
+// only when it contains the delimiter, a quote or a line break
+const void append_csv_field(const value_view &value, const string &delim, string &out)
+{
+    const char specials[] = "\"\r\n";
+    const bool needs_quotes = std::find_first_of(value.begin(), value.end(), specials, specials + 3) != value.end()
+                              || (!delim.empty() && value.contains(delim.data(), delim.size()));
+    if (!needs_quotes)
+    {
+        out += value;
+        return;
+    }
+    out += '"';
+    for (const char &c: value)
+    {
+        if (c == '"')
+        {
+            out += '"';
+        }
+        out += c;
+    }
+    out += '"';
+}
+
+// Appends value as a JSON string literal, escaped exactly like json::dump
+const void append_json_string(const value_view &value, string &out)
+{
+    out += json(value.str()).dump();
+}
+
+const json_layout json_row_layout(const generation_args &args)
+{
+    const bool has_keys = !args.pc.keys.empty();
+    json_layout layout;
+    if (args.type == output_type::jsonl)
+    {
+        layout.open = has_keys ? "{" : "[";
+        layout.key_separator = ":";
+        layout.value_separator = ",";
+        layout.close = has_keys ? "}\n" : "]\n";
+    }
+    else
+    {
+        layout.open = has_keys ? "{\n" : "[\n";
+        layout.indent = "    ";
+        layout.key_separator = ": ";
+        layout.value_separator = ",\n";
+        layout.close = has_keys ? "\n}" : "\n]";
+    }
+    return layout;
+}
+
+// Smallest of 1, 2, 4 or 8 bytes that can hold every index of the column
+const size_t dict_index_width(const size_t &cardinality)
+{
+    const unsigned long long max_index = cardinality > 0 ? cardinality - 1 : 0;
+    if (max_index <= 0xFFULL)
+    {
+        return 1;
+    }
+    if (max_index <= 0xFFFFULL)
+    {
+        return 2;
+    }
+    if (max_index <= 0xFFFFFFFFULL)
+    {
+        return 4;
+    }
+    return 8;
+}
+
+const void append_little_endian(const unsigned long long &value, const size_t &width, string &out)
+{
+    for (size_t b = 0; b < width; ++b)
+    {
+        out += static_cast<char>((value >> (8 * b)) & 0xFF);
+    }
+}
+
+const void append_dict_header(const generation_args &args, string &out)
+{
+    const value_table &combinations = args.pc.combinations;
+    string columns;
+    size_t record_width = 0;
+    for (size_t j = 0; j < combinations.size(); ++j)
+    {
+        const size_t width = dict_index_width(combinations[j].size());
+        const string key = args.pc.keys.empty() ? "" : args.pc.keys[j];
+        record_width += width;
+        append_little_endian(width, 1, columns);
+        append_little_endian(key.size(), 4, columns);
+        columns += key;
+        append_little_endian(combinations[j].size(), 8, columns);
+        for (const value_view &value: combinations[j])
+        {
+            append_little_endian(value.size, 4, columns);
+            columns += value;
+        }
+    }
+    const size_t unpadded = DICT_MAGIC.size() + 8 + 4 + 4 + columns.size();
+    const size_t header_size = (unpadded + 7) / 8 * 8;
+    out += DICT_MAGIC;
+    append_little_endian(header_size, 8, out);
+    append_little_endian(record_width, 4, out);
+    append_little_endian(combinations.size(), 4, out);
+    out += columns;
+    out.append(header_size - unpadded, '\0');
+}
+
+/*
+ * CSV fragments are the escaped value followed by the delimiter, or by the
+ * newline for the last column. JSON fragments hold the indentation, the key
+ * and the value followed by either the value separator or the closing
+ * bracket, so a row reads exactly like json_row_layout describes. Dict and
+ * Arrow fragments are the value's index at the column's index width. All of
+ * a column's fragments are packed next to each other in the fragment arena.
+ */
+row_fragments compile_fragments(const generation_args &args)
+{
+    row_fragments fragments;
+    const size_t columns = args.pc.combinations.size();
+    const bool is_json = args.type != output_type::csv;
+    const json_layout layout = json_row_layout(args);
+    for (size_t j = 0; j < columns; ++j)
+    {
+        fragments.columns.add_column();
+    }
+    string fragment;
+    if (args.type == output_type::dict || args.type == output_type::arrow)
+    {
+        for (size_t j = 0; j < columns; ++j)
+        {
+            const size_t cardinality = args.pc.combinations[j].size();
+            const size_t width = args.type == output_type::dict ? dict_index_width(cardinality) : arrow_index_width(cardinality);
+            for (size_t v = 0; v < cardinality; ++v)
+            {
+                fragment.clear();
+                append_little_endian(v, width, fragment);
+                fragments.columns.push_back(j, fragment);
+            }
+            fragments.mean_row_size += width;
+        }
+        return fragments;
+    }
+    if (is_json && columns == 0)
+    {
+        // No column fragment closes the row, so the prefix is the whole empty
+        // row, [] or {}, without the line breaks pretty-printing puts inside
+        fragments.row_prefix = layout.open.substr(0, 1) + layout.close.substr(layout.close.find_first_not_of('\n'));
+    }
+    else if (is_json)
+    {
+        fragments.row_prefix = layout.open;
+    }
+    else if (columns == 0)
+    {
+        // Likewise no column fragment ends the CSV row, so the prefix is its line break
+        fragments.row_prefix = "\n";
+    }
+    // Every value of a column is equally likely in every mode, so the mean
+    // fragment size per column adds up to the mean row size
+    fragments.mean_row_size = fragments.row_prefix.size() + (args.type == output_type::json ? 1 : 0);
+    for (size_t j = 0; j < columns; ++j)
+    {
+        const bool last = j + 1 == columns;
+        string key = layout.indent;
+        if (!args.pc.keys.empty())
+        {
+            append_json_string(args.pc.keys[j], key);
+            key += layout.key_separator;
+        }
+        size_t column_bytes = 0;
+        for (const value_view &value: args.pc.combinations[j])
+        {
+            fragment.clear();
+            if (is_json)
+            {
+                fragment = key;
+                append_json_string(value, fragment);
+                fragment += last ? layout.close : layout.value_separator;
+            }
+            else
+            {
+                append_csv_field(value, args.delim, fragment);
+                fragment += last ? "\n" : args.delim;
+            }
+            fragments.columns.push_back(j, fragment);
+            column_bytes += fragment.size();
+        }
+        if (column_bytes > 0)
+        {
+            fragments.mean_row_size += static_cast<double>(column_bytes) / args.pc.combinations[j].size();
+        }
+    }
+    return fragments;
+}
+
+row_serializer::row_serializer(const generation_args &args)
+    : args(args), column_ends(args.pc.combinations.size(), 0), batch_columns(args.pc.combinations.size()), batch_rows(0)
+{
+}
+
+void row_serializer::append(const combination_iterator &row, string &out)
+{
+    append_digits(row.current_digits().data(), row.first_changed(), out);
+}
+
+void row_serializer::append(const size_t *digits, string &out)
+{
+    append_digits(digits, 0, out);
+}
+
+void row_serializer::finish(string &out)
+{
+    if (batch_rows > 0)
+    {
+        append_arrow_record_batch(batch_columns, batch_rows, out);
+        for (string &column: batch_columns)
+        {
+            column.clear();
+        }
+        batch_rows = 0;
+    }
+}
+
+void row_serializer::append_digits(const size_t *digits, const size_t &first_changed, string &out)
+{
+    const value_table &columns = args.fragments.columns;
+    const size_t count = column_ends.size();
+    if (args.type == output_type::arrow)
+    {
+        for (size_t j = 0; j < count; ++j)
+        {
+            batch_columns[j] += columns[j][digits[j]];
+        }
+        if (++batch_rows == args.batch_size)
+        {
+            finish(out);
+        }
+        return;
+    }
+    // Columns before first_changed still hold the previous row's values
+    size_t column = first_changed;
+    if (column == 0)
+    {
+        cached_row = args.fragments.row_prefix;
+    }
+    else
+    {
+        cached_row.resize(column_ends[column - 1]);
+    }
+    for (; column < count; ++column)
+    {
+        cached_row += columns[column][digits[column]];
+        column_ends[column] = cached_row.size();
+    }
+    out += cached_row;
+}
+
+#endif
@@ -0,0 +1,91 @@
+/* row_serializer.h
+ *
+ * Copyright (C) 2018 Tyler Burdsall
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ROW_SERIALIZER_H
+#define ROW_SERIALIZER_H
+
+#include "combigen.h"
+
+// Punctuation around the keys and values of one JSON row: pretty-printed like
+// json::dump(4) for -t json, compact and newline-terminated for -t jsonl
+struct json_layout
+{
+    string                          open;
+    string                          indent;
+    string                          key_separator;
+    string                          value_separator;
+    string                          close;
+};
+
+/*
+ * -t dict writes the schema once, followed by one fixed-width record per row.
+ * All integers are little-endian:
+ *
+ *   8 bytes   magic "CMBGDCT1"
+ *   u64       header size, i.e. the offset of the first record (multiple of 8)
+ *   u32       record width in bytes
+ *   u32       column count
+ *   per column:
+ *     u8      index width in bytes (1, 2, 4 or 8)
+ *     u32     key length followed by the key (0 for keyless input)
+ *     u64     value count
+ *     per value: u32 length followed by the value
+ *   zero padding up to the header size
+ *
+ * A record holds each column's value index at the column's index width, in
+ * column order.
+ */
+const string                 DICT_MAGIC = "CMBGDCT1";
+
+const json_layout            json_row_layout(const generation_args &args);
+const size_t                 dict_index_width(const size_t &cardinality);
+const void                   append_little_endian(const unsigned long long &value, const size_t &width, string &out);
+const void                   append_dict_header(const generation_args &args, string &out);
+const void                   append_csv_field(const value_view &value, const string &delim, string &out);
+const void                   append_json_string(const value_view &value, string &out);
+row_fragments                compile_fragments(const generation_args &args);
+
+/*
+ * Turns rows into output bytes using the fragments compiled by
+ * compile_fragments. A row is the row prefix followed by one fragment per
+ * column; when rows from a combination_iterator are fed in order, the columns
+ * that did not change since the previous row are reused as-is. Arrow output
+ * is collected into record batches of args.batch_size rows, so finish() has to
+ * be called once the last row has been appended.
+ */
+class row_serializer
+{
+public:
+    explicit row_serializer(const generation_args &args);
+
+    void append(const combination_iterator &row, string &out);
+    // One digit per column
+    void append(const size_t *digits, string &out);
+    void finish(string &out);
+
+private:
+    void append_digits(const size_t *digits, const size_t &first_changed, string &out);
+
+    const generation_args           &args;
+    string                          cached_row;
+    vector<size_t>                  column_ends;
+    vector<string>                  batch_columns;
+    size_t                          batch_rows;
+};
+
+#endif
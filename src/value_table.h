@@ -0,0 +1,178 @@
+/* value_table.h
+ *
+ * Copyright (C) 2018 Tyler Burdsall
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef VALUE_TABLE_H
+#define VALUE_TABLE_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+using std::size_t;
+
+// Bytes per arena block; larger values get a block of their own
+const size_t                 VALUE_ARENA_BLOCK_SIZE = 1 << 20;
+
+// A string owned by a value_table, or by memory it keeps alive
+struct value_view
+{
+    value_view() : data(nullptr), size(0) {}
+    value_view(const char *data, const size_t &size) : data(data), size(size) {}
+    value_view(const std::string &value) : data(value.data()), size(value.size()) {}
+
+    const char *begin() const
+    {
+        return data;
+    }
+
+    const char *end() const
+    {
+        return data + size;
+    }
+
+    bool contains(const char *bytes, const size_t &length) const
+    {
+        return length <= size && std::search(begin(), end(), bytes, bytes + length) != end();
+    }
+
+    std::string str() const
+    {
+        return std::string(data, size);
+    }
+
+    const char                      *data;
+    size_t                          size;
+};
+
+inline std::string &operator+=(std::string &out, const value_view &value)
+{
+    return out.append(value.data, value.size);
+}
+
+typedef std::vector<value_view> value_column;
+
+/*
+ * Columns of strings without an allocation per string. Bytes that are
+ * copied in are packed back to back into large arena blocks; bytes that
+ * already live in memory the table keeps alive, like a mapped input file, are
+ * referenced where they are. Either way each column is a flat table of
+ * (pointer, length) views, so reading a value is one lookup with no pointer
+ * chasing through string headers.
+ *
+ * Views stay valid when the table is moved, so it can be returned by value,
+ * but it cannot be copied.
+ */
+class value_table
+{
+public:
+    value_table() : block_used(0), block_capacity(0) {}
+
+    value_table(value_table &&) = default;
+    value_table &operator=(value_table &&) = default;
+    value_table(const value_table &) = delete;
+    value_table &operator=(const value_table &) = delete;
+
+    void add_column()
+    {
+        columns.emplace_back();
+    }
+
+    // Copies the bytes into the arena and appends them to the given column
+    void push_back(const size_t &column, const char *bytes, const size_t &size)
+    {
+        columns[column].push_back(store(bytes, size));
+    }
+
+    void push_back(const size_t &column, const std::string &value)
+    {
+        push_back(column, value.data(), value.size());
+    }
+
+    // Appends bytes that outlive the table, e.g. ones inside a kept source
+    void push_view(const size_t &column, const value_view &value)
+    {
+        columns[column].push_back(value);
+    }
+
+    // Copies the bytes into the arena without adding them to any column
+    value_view store(const char *bytes, const size_t &size)
+    {
+        if (size == 0)
+        {
+            return value_view();
+        }
+        if (size > block_capacity - block_used)
+        {
+            block_capacity = std::max(VALUE_ARENA_BLOCK_SIZE, size);
+            blocks.emplace_back(new char[block_capacity]);
+            block_used = 0;
+        }
+        char *target = blocks.back().get() + block_used;
+        std::memcpy(target, bytes, size);
+        block_used += size;
+        return value_view(target, size);
+    }
+
+    // Keeps the memory behind push_view alive for as long as the table
+    void keep(const std::shared_ptr<const void> &source)
+    {
+        sources.push_back(source);
+    }
+
+    void append_column(value_column &&values)
+    {
+        columns.push_back(std::move(values));
+    }
+
+    const value_column &operator[](const size_t &column) const
+    {
+        return columns[column];
+    }
+
+    size_t size() const
+    {
+        return columns.size();
+    }
+
+    bool empty() const
+    {
+        return columns.empty();
+    }
+
+    std::vector<value_column>::const_iterator begin() const
+    {
+        return columns.begin();
+    }
+
+    std::vector<value_column>::const_iterator end() const
+    {
+        return columns.end();
+    }
+
+private:
+    std::vector<value_column>              columns;
+    std::vector<std::unique_ptr<char[]>>   blocks;
+    size_t                                 block_used;
+    size_t                                 block_capacity;
+    std::vector<std::shared_ptr<const void>> sources;
+};
+
+#endif